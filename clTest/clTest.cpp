@@ -4,323 +4,6154 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <map>
+#include <cstdint>
+#include <filesystem>
+#include <set>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <cstring>
+#include <climits>
+#include <cstdarg>
+#include <iomanip>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
 
 using namespace cv;
 using namespace dnn;
 using namespace std;
+namespace fs = std::filesystem;
+
+// --- Счетчик выделений памяти ---
+// Считаются выделения через new и буферы Mat (через аллокатор ниже).
+// Нужен, чтобы проверить, что прогретый запрос не выделяет память.
+// new считается по потокам: каждый поток считает свои выделения, а потоки пула - еще и в счетчик
+// группы пула, и запрос суммирует только свой поток и пул движка (без потоков журнала, чтения
+// stdin, каталога и соседних движков). Буферы Mat считаются на весь процесс: сеть выполняется
+// в потоках parallel_for_ самого OpenCV, и только так в запрос попадают ее Mat. Поэтому число
+// точное, пока движок один и каталог не перезагружается, иначе - оценка сверху.
+// Не видны: new внутри библиотек OpenCV (замена operator new действует только на модуль exe,
+// а на Windows OpenCV - отдельная DLL) и fastMalloc/AutoBuffer. "allocs 0" значит, что нет
+// новых буферов Mat и new в нашем коде, а не что запрос совсем не трогал кучу.
+atomic<unsigned long long> allocationCount{ 0 };
+atomic<unsigned long long> matAllocationCount{ 0 };
+thread_local bool allocationCountingPaused = false;
+thread_local unsigned long long threadAllocationCount = 0;
+
+struct AllocationGroup {
+    atomic<unsigned long long> count{ 0 };
+};
+
+thread_local AllocationGroup* threadAllocationGroup = nullptr;
+
+inline void countAllocation() {
+    if (allocationCountingPaused) {
+        return;
+    }
+    ++allocationCount;
+    ++threadAllocationCount;
+    if (threadAllocationGroup != nullptr) {
+        threadAllocationGroup->count.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void* operator new(size_t size) {
+    countAllocation();
+    if (void* p = malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+class CountingMatAllocator : public MatAllocator {
+public:
+    UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+        AccessFlag flags, UMatUsageFlags usageFlags) const override {
+        if (data == nullptr && !allocationCountingPaused) {
+            ++allocationCount;
+            ++matAllocationCount;
+        }
+        return Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(UMatData* data, AccessFlag accessFlags, UMatUsageFlags usageFlags) const override {
+        return Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+    }
+
+    void deallocate(UMatData* data) const override {
+        Mat::getStdAllocator()->deallocate(data);
+    }
+};
+
+CountingMatAllocator countingMatAllocator;
+
+// Добавляет к total число выделений new текущего потока и потоков group и буферов Mat
+// всего процесса за время жизни объекта
+struct AllocationScope {
+    unsigned long long& total;
+    const AllocationGroup* group;
+    unsigned long long start;
+
+    explicit AllocationScope(unsigned long long& counter, const AllocationGroup* group = nullptr)
+        : total(counter), group(group), start(current()) {}
+    ~AllocationScope() {
+        total += current() - start;
+    }
+
+    unsigned long long current() const {
+        return threadAllocationCount + (group != nullptr ? group->count.load() : 0) + matAllocationCount.load();
+    }
+};
+
+// Выделения в этом потоке не считаются, пока объект жив (ввод-вывод: чтение одежды, JPEG)
+struct AllocationPause {
+    bool previous;
+
+    AllocationPause() : previous(allocationCountingPaused) {
+        allocationCountingPaused = true;
+    }
+    ~AllocationPause() {
+        allocationCountingPaused = previous;
+    }
+};
+
+// --- Асинхронный журнал ---
+// Сообщение форматируется в запись фиксированного размера и кладется в кольцевой буфер своего
+// потока (один писатель, один читатель, без блокировок). В stderr записи выводит фоновый поток,
+// по порядку номеров, одной записью на пачку. Рабочий поток никогда не ждет: если его буфер
+// полон, сообщение отбрасывается и учитывается. Одно и то же сообщение (по строке формата)
+// выводится не чаще logBurst раз в секунду, число подавленных дописывается к следующему.
+enum class LogLevel { Info, Warn, Error };
+
+const char* const logLevelNames[] = { "INFO", "WARN", "ERROR" };
+
+atomic<int> logMinLevel{ static_cast<int>(LogLevel::Info) };
+
+// Номер запроса для строк журнала; граф запроса выставляет его в каждом узле
+thread_local long long logRequestId = 0;
+
+struct LogRequestScope {
+    long long previous;
+
+    explicit LogRequestScope(long long id) : previous(logRequestId) {
+        logRequestId = id;
+    }
+    ~LogRequestScope() {
+        logRequestId = previous;
+    }
+};
+
+struct LogRecord {
+    unsigned long long sequence;
+    double seconds;       // от создания журнала (старта процесса)
+    long long requestId;
+    int level;
+    int suppressed;       // сколько таких же сообщений подавлено перед этим
+    char text[224];
+};
+
+class LogRing {
+public:
+    bool push(const LogRecord& record) {
+        size_t position = head.load(memory_order_relaxed);
+        if (position - tail.load(memory_order_acquire) == capacity) {
+            return false;
+        }
+        records[position % capacity] = record;
+        head.store(position + 1, memory_order_release);
+        return true;
+    }
+
+    bool pop(LogRecord& record) {
+        size_t position = tail.load(memory_order_relaxed);
+        if (position == head.load(memory_order_acquire)) {
+            return false;
+        }
+        record = records[position % capacity];
+        tail.store(position + 1, memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return tail.load(memory_order_acquire) == head.load(memory_order_acquire);
+    }
+
+    atomic<bool> retired{ false }; // поток завершился, буфер удаляется после вывода
+
+private:
+    static const size_t capacity = 256;
+    LogRecord records[capacity];
+    atomic<size_t> head{ 0 };
+    atomic<size_t> tail{ 0 };
+};
+
+// Поток уже отдал свой буфер журналу; флаг без деструктора, поэтому его можно читать и из
+// деструкторов thread_local, которые выполняются позже ThreadLogRing
+thread_local bool threadLogRetired = false;
+
+// Буфер потока живет у журнала: после завершения потока его записи все равно выводятся,
+// а сам буфер журнал удаляет, как только выведет их
+struct ThreadLogRing {
+    LogRing* ring = nullptr;
+
+    ~ThreadLogRing() {
+        if (ring != nullptr) {
+            ring->retired = true;
+            ring = nullptr;
+        }
+        threadLogRetired = true;
+    }
+};
+
+thread_local ThreadLogRing threadLogRing;
+
+class AsyncLogger {
+    friend class AsyncLoggerTest; // tests/clTestTests.cpp проверяет admit напрямую
+
+public:
+    ~AsyncLogger() {
+        {
+            lock_guard<mutex> lock(ringsMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (drainer.joinable()) {
+            drainer.join();
+        }
+        drain();
+    }
+
+    void write(LogLevel level, const char* format, va_list args) {
+        if (static_cast<int>(level) < logMinLevel.load(memory_order_relaxed)) {
+            return;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        int suppressed = 0;
+        if (!admit(format, static_cast<long long>(seconds), suppressed)) {
+            return;
+        }
+        LogRecord record;
+        record.sequence = ++sequence;
+        record.seconds = seconds;
+        record.requestId = logRequestId;
+        record.level = static_cast<int>(level);
+        record.suppressed = suppressed;
+        vsnprintf(record.text, sizeof(record.text), format, args);
+        LogRing* ring = threadRing();
+        if (ring == nullptr || !ring->push(record)) {
+            ++dropped;
+        }
+    }
+
+private:
+    // Первое сообщение потока регистрирует его буфер (единственное место с мьютексом).
+    // После завершения потока буфера нет: сообщения из поздних деструкторов считаются отброшенными.
+    LogRing* threadRing() {
+        if (threadLogRetired) {
+            return nullptr;
+        }
+        if (threadLogRing.ring == nullptr) {
+            AllocationPause pause;
+            lock_guard<mutex> lock(ringsMutex);
+            rings.emplace_back(new LogRing());
+            threadLogRing.ring = rings.back().get();
+            if (!drainer.joinable() && !stopping) {
+                drainer = thread([this] { drainLoop(); });
+            }
+        }
+        return threadLogRing.ring;
+    }
+
+    // Ограничение повторов: ячейка на строку формата, счетчик в пределах текущей секунды
+    bool admit(const char* format, long long second, int& suppressed) {
+        size_t start = (reinterpret_cast<uintptr_t>(format) >> 3) % rateSlotCount;
+        for (size_t probe = 0; probe < 8; ++probe) {
+            RateSlot& slot = rateSlots[(start + probe) % rateSlotCount];
+            const char* owner = slot.format.load();
+            if (owner == nullptr && slot.format.compare_exchange_strong(owner, format)) {
+                owner = format;
+            }
+            if (owner != format) {
+                continue;
+            }
+            // Секунда и счетчик меняются одним CAS: иначе поток, сбросивший окно, может
+            // затереть приращения других потоков, уже увидевших новую секунду
+            unsigned long long window = slot.window.load();
+            unsigned long long next;
+            do {
+                bool sameSecond = static_cast<long long>(window >> 32) == second;
+                if (sameSecond && (window & 0xffffffffu) >= logBurst) {
+                    ++slot.suppressed;
+                    return false;
+                }
+                next = sameSecond ? window + 1 : static_cast<unsigned long long>(second) << 32 | 1;
+            } while (!slot.window.compare_exchange_weak(window, next));
+            suppressed = slot.suppressed.exchange(0);
+            return true;
+        }
+        return true; // таблица занята другими сообщениями - без ограничения
+    }
+
+    void drainLoop() {
+        unique_lock<mutex> lock(ringsMutex);
+        while (!stopping) {
+            wake.wait_for(lock, chrono::milliseconds(20));
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    }
+
+    // Забирает записи всех потоков и выводит их одной записью в порядке номеров.
+    // Пачка и строка вывода растут в куче, поэтому выделения журнала не считаются
+    // (деструктор выводит остаток из потока, который мог бы считать свои)
+    void drain() {
+        AllocationPause pause;
+        batch.clear();
+        {
+            lock_guard<mutex> lock(ringsMutex);
+            LogRecord record;
+            for (size_t i = 0; i < rings.size();) {
+                while (rings[i]->pop(record)) {
+                    batch.push_back(record);
+                }
+                if (rings[i]->retired && rings[i]->empty()) {
+                    rings.erase(rings.begin() + i);
+                }
+                else {
+                    ++i;
+                }
+            }
+        }
+        unsigned long long lost = dropped.exchange(0);
+        if (batch.empty() && lost == 0) {
+            return;
+        }
+        sort(batch.begin(), batch.end(), [](const LogRecord& a, const LogRecord& b) { return a.sequence < b.sequence; });
+        ostringstream text;
+        text << fixed << setprecision(3);
+        for (const LogRecord& record : batch) {
+            text << "[" << logLevelNames[record.level] << "] t=" << record.seconds;
+            if (record.requestId != 0) {
+                text << " req=" << record.requestId;
+            }
+            text << " " << record.text;
+            if (record.suppressed > 0) {
+                text << " (подавлено таких же: " << record.suppressed << ")";
+            }
+            text << "\n";
+        }
+        if (lost > 0) {
+            text << "[WARN] Журнал: буферы потоков переполнены, отброшено сообщений: " << lost << "\n";
+        }
+        cerr << text.str() << flush;
+    }
+
+    struct RateSlot {
+        atomic<const char*> format{ nullptr };
+        atomic<unsigned long long> window{ 0 }; // секунда << 32 | сообщений в этой секунде
+        atomic<int> suppressed{ 0 };
+    };
+
+    static const int logBurst = 5;
+    static const size_t rateSlotCount = 64;
+
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    mutex ringsMutex;
+    condition_variable wake;
+    vector<unique_ptr<LogRing>> rings;
+    vector<LogRecord> batch;
+    thread drainer;
+    bool stopping = false;
+    atomic<unsigned long long> sequence{ 0 };
+    atomic<unsigned long long> dropped{ 0 };
+    RateSlot rateSlots[rateSlotCount];
+};
+
+AsyncLogger asyncLogger;
+
+#ifdef __GNUC__
+#define LOG_PRINTF_FORMAT __attribute__((format(printf, 1, 2)))
+#else
+#define LOG_PRINTF_FORMAT
+#endif
+
+void logError(const char* format, ...) LOG_PRINTF_FORMAT;
+void logWarn(const char* format, ...) LOG_PRINTF_FORMAT;
+void logInfo(const char* format, ...) LOG_PRINTF_FORMAT;
+
+void logError(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    asyncLogger.write(LogLevel::Error, format, args);
+    va_end(args);
+}
+
+void logWarn(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    asyncLogger.write(LogLevel::Warn, format, args);
+    va_end(args);
+}
+
+void logInfo(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    asyncLogger.write(LogLevel::Info, format, args);
+    va_end(args);
+}
+
+// --- Метрики движка ---
+// Счетчики и гистограммы в текстовом формате Prometheus. Обновление - только атомики,
+// без выделений памяти, чтобы не ломать прогретый запрос. Файл подхватывает
+// node_exporter (textfile collector) или любой другой сборщик.
+enum class Stage {
+    Decode,     // imread фото и одежды
+    Inference,  // подготовка входа и forward сети
+    Keypoints,  // ключевые точки из выхода сети
+    Localize,   // поиск человека на кадре для кропа перед сетью
+    Unpack,     // распаковка сжатой одежды целиком (карусель)
+    Scrub,      // кадр предпросмотра при прокрутке карусели (с выдачей)
+    Preview,    // предпросмотр целиком (с кодированием)
+    Blend,      // наложение одежды на полный кадр
+    Encode,     // JPEG или запись в общую память
+    ModelLoad,  // разбор prototxt и весов
+    Warmup,     // прогревочный forward при старте
+    Count
+};
+
+const char* const stageNames[] = { "decode", "inference", "keypoints", "localize", "unpack", "scrub", "preview", "blend", "encode", "model_load", "warmup" };
+
+// Время старта процесса, от него считается время до первого результата
+const chrono::steady_clock::time_point processStart = chrono::steady_clock::now();
+
+// Классы запросов сервера и уровни исполнения при нехватке времени до срока (см. runServeMode)
+enum class RequestClass { Interactive, Batch, Count };
+const char* const requestClassNames[] = { "interactive", "batch" };
+enum class RenderTier {
+    Full,        // предпросмотр и полный кадр
+    Reduced,     // фото уменьшено до reducedTierMaxSide
+    PreviewOnly, // только предпросмотр, без полного кадра
+    Count
+};
+const char* const renderTierNames[] = { "full", "reduced", "preview" };
+enum class DeadlineResult { Met, Missed, Shed, Count };
+const char* const deadlineResultNames[] = { "met", "missed", "shed" };
+
+// Типы одежды для меток; все остальное попадает в "other"
+const char* const metricGarmentTypes[] = { "tshirt", "pants", "hat", "glasses", "other" };
+const int METRIC_GARMENT_TYPES = 5;
+
+const double latencyBucketsMs[] = { 1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 2500 };
+const double allocationBuckets[] = { 0, 1, 10, 100, 1000, 10000 };
+
+class Histogram {
+public:
+    template <size_t N>
+    explicit Histogram(const double (&bounds)[N]) : bounds(bounds), boundCount(N) {}
+
+    void observe(double value) {
+        size_t bucket = 0;
+        while (bucket < boundCount && value > bounds[bucket]) {
+            ++bucket;
+        }
+        ++buckets[bucket];
+        ++count;
+        // Сумма хранится в тысячных долях, atomic<double> в C++17 не умеет fetch_add
+        sumMilli += static_cast<unsigned long long>(value * 1000.0);
+    }
+
+    void write(ostream& out, const string& name, const string& labels) const {
+        string prefix = labels.empty() ? "{" : "{" + labels + ",";
+        unsigned long long cumulative = 0;
+        for (size_t i = 0; i < boundCount; ++i) {
+            cumulative += buckets[i].load();
+            out << name << "_bucket" << prefix << "le=\"" << bounds[i] << "\"} " << cumulative << "\n";
+        }
+        cumulative += buckets[boundCount].load();
+        out << name << "_bucket" << prefix << "le=\"+Inf\"} " << cumulative << "\n";
+        string plain = labels.empty() ? "" : "{" + labels + "}";
+        out << name << "_sum" << plain << " " << sumMilli.load() / 1000.0 << "\n";
+        out << name << "_count" << plain << " " << count.load() << "\n";
+    }
+
+private:
+    static const size_t MAX_BUCKETS = 16;
+    const double* bounds;
+    size_t boundCount;
+    atomic<unsigned long long> buckets[MAX_BUCKETS + 1] = {};
+    atomic<unsigned long long> count{ 0 };
+    atomic<unsigned long long> sumMilli{ 0 };
+};
+
+int metricGarmentIndex(const char* clothingType) {
+    for (int i = 0; i < METRIC_GARMENT_TYPES - 1; ++i) {
+        if (strcmp(clothingType, metricGarmentTypes[i]) == 0) {
+            return i;
+        }
+    }
+    return METRIC_GARMENT_TYPES - 1;
+}
+
+// Пиковое потребление памяти процессом, в байтах
+unsigned long long peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#elif defined(__linux__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<unsigned long long>(usage.ru_maxrss) * 1024; // ru_maxrss в килобайтах
+#else
+    return 0;
+#endif
+}
+
+class EngineMetrics {
+public:
+    EngineMetrics()
+        : stageLatency{ Histogram(latencyBucketsMs), Histogram(latencyBucketsMs), Histogram(latencyBucketsMs),
+                        Histogram(latencyBucketsMs), Histogram(latencyBucketsMs), Histogram(latencyBucketsMs),
+                        Histogram(latencyBucketsMs), Histogram(latencyBucketsMs), Histogram(latencyBucketsMs),
+                        Histogram(latencyBucketsMs), Histogram(latencyBucketsMs) },
+          requestLatency(latencyBucketsMs),
+          requestAllocations(allocationBuckets) {}
+
+    void observeStage(Stage stage, double milliseconds) {
+        stageLatency[static_cast<int>(stage)].observe(milliseconds);
+    }
+
+    void observeRequest(const string& clothingType, bool ok, double milliseconds, unsigned long long allocations) {
+        ++requests[metricGarmentIndex(clothingType.c_str())][ok ? 1 : 0];
+        requestLatency.observe(milliseconds);
+        requestAllocations.observe(static_cast<double>(allocations));
+    }
+
+    // Вызывается из calculate*, когда нужная точка не найдена (значение -1)
+    void countMissingKeypoints(const char* clothingType) {
+        ++missingKeypoints[metricGarmentIndex(clothingType)];
+    }
+
+    void countGarmentCache(bool hit) {
+        ++(hit ? garmentCacheHits : garmentCacheMisses);
+    }
+
+    void countEarlyExit(bool accepted) {
+        ++(accepted ? earlyExitAccepted : earlyExitEscalated);
+    }
+
+    void addQueuedTasks(long long delta) {
+        queuedTasks += delta;
+    }
+
+    // Запрос прокрутки пропущен, потому что за ним в очереди уже есть более новый
+    void countScrubDropped() {
+        ++scrubDropped;
+    }
+
+    // Исход запроса со сроком: успел, опоздал или отброшен без выполнения
+    void countDeadline(RequestClass requestClass, DeadlineResult result) {
+        ++deadlines[static_cast<int>(requestClass)][static_cast<int>(result)];
+    }
+
+    void countTier(RenderTier tier) {
+        ++tiers[static_cast<int>(tier)];
+    }
+
+    // Пакетный запрос прерван на границе стадий ради интерактивного и возвращен в очередь
+    void countPreempted() {
+        ++preempted;
+    }
+
+    // Сколько памяти занимают картинки текущего снимка каталога
+    void setCatalogBytes(unsigned long long bytes) {
+        catalogBytes = bytes;
+    }
+
+    // Запоминает время от старта процесса до первого результата; true только для первого
+    bool markFirstResult(double milliseconds) {
+        bool expected = false;
+        if (!firstResultSeen.compare_exchange_strong(expected, true)) {
+            return false;
+        }
+        firstResultMicros = static_cast<unsigned long long>(milliseconds * 1000.0);
+        return true;
+    }
+
+    void write(ostream& out) const {
+        out << "# HELP outfitme_stage_duration_ms Stage latency in milliseconds.\n";
+        out << "# TYPE outfitme_stage_duration_ms histogram\n";
+        for (int i = 0; i < static_cast<int>(Stage::Count); ++i) {
+            stageLatency[i].write(out, "outfitme_stage_duration_ms", string("stage=\"") + stageNames[i] + "\"");
+        }
+        out << "# HELP outfitme_request_duration_ms Whole try-on request latency in milliseconds.\n";
+        out << "# TYPE outfitme_request_duration_ms histogram\n";
+        requestLatency.write(out, "outfitme_request_duration_ms", "");
+        out << "# HELP outfitme_request_allocations Allocations made by the compute part of a request: new in the "
+            "engine's own code on the request and pool threads, plus Mat buffers process-wide (exact only with one idle "
+            "engine and no catalog reload). new inside the OpenCV library and fastMalloc/AutoBuffer are not seen.\n";
+        out << "# TYPE outfitme_request_allocations histogram\n";
+        requestAllocations.write(out, "outfitme_request_allocations", "");
+
+        out << "# HELP outfitme_requests_total Try-on requests by garment type and outcome.\n";
+        out << "# TYPE outfitme_requests_total counter\n";
+        for (int i = 0; i < METRIC_GARMENT_TYPES; ++i) {
+            out << "outfitme_requests_total{type=\"" << metricGarmentTypes[i] << "\",result=\"error\"} " << requests[i][0].load() << "\n";
+            out << "outfitme_requests_total{type=\"" << metricGarmentTypes[i] << "\",result=\"ok\"} " << requests[i][1].load() << "\n";
+        }
+        out << "# HELP outfitme_missing_keypoints_total Placements that fell back because a keypoint was missing.\n";
+        out << "# TYPE outfitme_missing_keypoints_total counter\n";
+        for (int i = 0; i < METRIC_GARMENT_TYPES; ++i) {
+            out << "outfitme_missing_keypoints_total{type=\"" << metricGarmentTypes[i] << "\"} " << missingKeypoints[i].load() << "\n";
+        }
+
+        out << "# HELP outfitme_garment_cache_total Garment cache lookups.\n";
+        out << "# TYPE outfitme_garment_cache_total counter\n";
+        out << "outfitme_garment_cache_total{result=\"hit\"} " << garmentCacheHits.load() << "\n";
+        out << "outfitme_garment_cache_total{result=\"miss\"} " << garmentCacheMisses.load() << "\n";
+
+        out << "# HELP outfitme_early_exit_total Early-exit inferences kept or escalated to the full network.\n";
+        out << "# TYPE outfitme_early_exit_total counter\n";
+        out << "outfitme_early_exit_total{result=\"accepted\"} " << earlyExitAccepted.load() << "\n";
+        out << "outfitme_early_exit_total{result=\"escalated\"} " << earlyExitEscalated.load() << "\n";
+
+        out << "# HELP outfitme_queue_depth Tasks waiting in the worker pool.\n";
+        out << "# TYPE outfitme_queue_depth gauge\n";
+        out << "outfitme_queue_depth " << queuedTasks.load() << "\n";
+        out << "# HELP outfitme_scrub_dropped_total Carousel scrub requests skipped in favour of a newer one.\n";
+        out << "# TYPE outfitme_scrub_dropped_total counter\n";
+        out << "outfitme_scrub_dropped_total " << scrubDropped.load() << "\n";
+        out << "# HELP outfitme_deadline_total Server requests with a deadline by class and outcome.\n";
+        out << "# TYPE outfitme_deadline_total counter\n";
+        for (int c = 0; c < static_cast<int>(RequestClass::Count); ++c) {
+            for (int r = 0; r < static_cast<int>(DeadlineResult::Count); ++r) {
+                out << "outfitme_deadline_total{class=\"" << requestClassNames[c] << "\",result=\"" << deadlineResultNames[r] << "\"} "
+                    << deadlines[c][r].load() << "\n";
+            }
+        }
+        out << "# HELP outfitme_render_tier_total Try-on requests by the tier chosen to meet the deadline.\n";
+        out << "# TYPE outfitme_render_tier_total counter\n";
+        for (int t = 0; t < static_cast<int>(RenderTier::Count); ++t) {
+            out << "outfitme_render_tier_total{tier=\"" << renderTierNames[t] << "\"} " << tiers[t].load() << "\n";
+        }
+        out << "# HELP outfitme_preempted_total Batch requests interrupted at a stage boundary by interactive work.\n";
+        out << "# TYPE outfitme_preempted_total counter\n";
+        out << "outfitme_preempted_total " << preempted.load() << "\n";
+        out << "# HELP outfitme_catalog_garment_bytes Memory held by garment images of the current catalog snapshot.\n";
+        out << "# TYPE outfitme_catalog_garment_bytes gauge\n";
+        out << "outfitme_catalog_garment_bytes " << catalogBytes.load() << "\n";
+        if (firstResultSeen.load()) {
+            out << "# HELP outfitme_time_to_first_result_ms Time from process start to the first result frame.\n";
+            out << "# TYPE outfitme_time_to_first_result_ms gauge\n";
+            out << "outfitme_time_to_first_result_ms " << firstResultMicros.load() / 1000.0 << "\n";
+        }
+        out << "# HELP outfitme_peak_rss_bytes Peak resident memory of the engine process.\n";
+        out << "# TYPE outfitme_peak_rss_bytes gauge\n";
+        out << "outfitme_peak_rss_bytes " << peakResidentBytes() << "\n";
+        out << "# HELP outfitme_allocations_total Allocations since start (new in the engine's own code and Mat buffers).\n";
+        out << "# TYPE outfitme_allocations_total counter\n";
+        out << "outfitme_allocations_total " << allocationCount.load() << "\n";
+    }
+
+    // Файл пишется целиком во временный и переименовывается, сборщик не видит половину
+    bool writeFile(const string& path) const {
+        ostringstream text;
+        write(text);
+        string tmpPath = path + ".tmp";
+        {
+            ofstream file(tmpPath, ios::binary | ios::trunc);
+            if (!file.is_open()) {
+                logError("Не удалось записать метрики: %s", tmpPath.c_str());
+                return false;
+            }
+            file << text.str();
+        }
+        remove(path.c_str());
+        if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+            logError("Не удалось переименовать файл метрик: %s", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    Histogram stageLatency[static_cast<int>(Stage::Count)];
+    Histogram requestLatency;
+    Histogram requestAllocations;
+    atomic<unsigned long long> requests[METRIC_GARMENT_TYPES][2] = {};
+    atomic<unsigned long long> missingKeypoints[METRIC_GARMENT_TYPES] = {};
+    atomic<unsigned long long> garmentCacheHits{ 0 };
+    atomic<unsigned long long> garmentCacheMisses{ 0 };
+    atomic<unsigned long long> earlyExitAccepted{ 0 };
+    atomic<unsigned long long> earlyExitEscalated{ 0 };
+    atomic<long long> queuedTasks{ 0 };
+    atomic<unsigned long long> catalogBytes{ 0 };
+    atomic<unsigned long long> scrubDropped{ 0 };
+    atomic<unsigned long long> deadlines[static_cast<int>(RequestClass::Count)][static_cast<int>(DeadlineResult::Count)] = {};
+    atomic<unsigned long long> tiers[static_cast<int>(RenderTier::Count)] = {};
+    atomic<unsigned long long> preempted{ 0 };
+    atomic<bool> firstResultSeen{ false };
+    atomic<unsigned long long> firstResultMicros{ 0 };
+};
+
+EngineMetrics engineMetrics;
+
+// Замер одной стадии: время от создания до разрушения объекта
+struct StageTimer {
+    Stage stage;
+    chrono::steady_clock::time_point start;
+
+    explicit StageTimer(Stage stage) : stage(stage), start(chrono::steady_clock::now()) {}
+    ~StageTimer() {
+        engineMetrics.observeStage(stage, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+};
+
+// --- Функция получения буфера нужного размера из арены ---
+// Арена только растет, поэтому после прогрева новых выделений нет.
+Mat arenaView(Mat& arena, Size size, int type) {
+    size_t needed = static_cast<size_t>(size.area()) * CV_ELEM_SIZE(type);
+    if (arena.empty() || arena.total() * arena.elemSize() < needed) {
+        arena.create(1, static_cast<int>(needed), CV_8U);
+    }
+    return Mat(size, type, arena.data);
+}
+
+// --- Функция смешивания уже отмасштабированной одежды с кадром ---
+// Обрабатываются только строки кадра из rows, поэтому кадр можно делить на полосы между потоками.
+void blendResizedItem(Mat& output, const Mat& resizedItem, Point2i location, Range rows) {
+    // Обрабатываем только ту часть одежды, которая попадает в кадр
+    Rect visible = Rect(location, resizedItem.size()) & Rect(0, rows.start, output.cols, rows.end - rows.start);
+    for (int bgY = visible.y; bgY < visible.y + visible.height; ++bgY) {
+        const Vec4b* fgRow = resizedItem.ptr<Vec4b>(bgY - location.y);
+        Vec3b* bgRow = output.ptr<Vec3b>(bgY);
+        for (int bgX = visible.x; bgX < visible.x + visible.width; ++bgX) {
+            const Vec4b& fgPixel = fgRow[bgX - location.x];
+            Vec3b& bgPixel = bgRow[bgX];
+
+            float alpha = fgPixel[3] / 255.0f;
+            for (int c = 0; c < 3; ++c) {
+                bgPixel[c] = saturate_cast<uchar>(alpha * fgPixel[c] + (1.0f - alpha) * bgPixel[c]);
+            }
+        }
+    }
+}
+
+// --- Функция наложения одежды прямо в кадр ---
+// resizedItem - буфер под одежду нужного размера, переиспользуется между запросами.
+bool overlayImageInPlace(Mat& output, const Mat& foreground, Point2i location, Size itemSize, Mat& resizedItem) {
+    if (output.empty() || foreground.empty()) {
+        logError("Одно из изображений пустое!");
+        return false;
+    }
+
+    if (foreground.channels() != 4) {
+        logError("Изображение одежды должно иметь 4 канала (RGBA)!");
+        return false;
+    }
+
+    resize(foreground, resizedItem, itemSize);
+    blendResizedItem(output, resizedItem, location, Range(0, output.rows));
+    return true;
+}
 
 // --- Функция отображения изображения ---
 Mat overlayImage(const Mat& background, const Mat& foreground, Point2i location, Size itemSize) {
-    if (background.empty() || foreground.empty()) {
-        cerr << "[ERROR] Одно из изображений пустое!" << endl;
-        return background.clone();
+    Mat output = background.clone();
+    Mat resizedItem;
+    overlayImageInPlace(output, foreground, location, itemSize, resizedItem);
+    return output;
+}
+
+// --- Функция наложения одежды на уменьшенное изображение ---
+// Положение и размер посчитаны для полного кадра и переводятся в масштаб уменьшенного фона.
+Mat overlayImageScaled(const Mat& smallBackground, const Mat& foreground, Point2i location, Size itemSize, double scale) {
+    Size scaledSize(max(1, static_cast<int>(itemSize.width * scale)), max(1, static_cast<int>(itemSize.height * scale)));
+    Point2i scaledLocation(static_cast<int>(location.x * scale), static_cast<int>(location.y * scale));
+    return overlayImage(smallBackground, foreground, scaledLocation, scaledSize);
+}
+
+// --- Функция расчета размера кадра с заданной длинной стороной ---
+Size scaledSizeForMaxSide(Size frameSize, int maxSide, double& scale) {
+    scale = min(1.0, static_cast<double>(maxSide) / max(frameSize.width, frameSize.height));
+    return Size(max(1, static_cast<int>(frameSize.width * scale)), max(1, static_cast<int>(frameSize.height * scale)));
+}
+
+// --- Файл, отображенный в память только для чтения ---
+// Страницы берутся прямо из файлового кэша ОС, без промежуточного буфера чтения,
+// и общие для всех процессов, отобразивших тот же файл.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        release();
+    }
+
+    bool open(const string& path) {
+        release();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            release();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr) {
+            release();
+            return false;
+        }
+        bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = static_cast<size_t>(fileSize.QuadPart);
+#elif defined(__linux__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        madvise(mapped, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        bytes = static_cast<const char*>(mapped);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        if (bytes == nullptr) {
+            release();
+            return false;
+        }
+        return true;
+    }
+
+    void release() {
+#ifdef _WIN32
+        if (bytes != nullptr) {
+            UnmapViewOfFile(bytes);
+        }
+        if (mapping != nullptr) {
+            CloseHandle(mapping);
+            mapping = nullptr;
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+#elif defined(__linux__)
+        if (bytes != nullptr) {
+            munmap(const_cast<char*>(bytes), length);
+        }
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+    const char* bytes = nullptr;
+    size_t length = 0;
+};
+
+// --- Функция загрузки модели OpenPose ---
+// Модель разбирается прямо из отображенных в память файлов; если отобразить не удалось - обычное чтение
+Net loadPoseNet(const string& modelPath, const string& protoPath) {
+    StageTimer timer(Stage::ModelLoad);
+    MappedFile model, proto;
+    Net net;
+    if (model.open(modelPath) && proto.open(protoPath)) {
+        net = readNetFromCaffe(proto.data(), proto.size(), model.data(), model.size());
+    }
+    else {
+        logInfo("Модель читается без отображения в память: %s", modelPath.c_str());
+        net = readNet(modelPath, protoPath);
+    }
+    if (net.empty()) {
+        logError("Ошибка загрузки модели OpenPose!");
+    }
+    return net;
+}
+
+// --- Функция извлечения ключевых точек из выхода сети ---
+// Ключевые точки пишутся в переданный вектор, чтобы его можно было переиспользовать.
+void extractKeypoints(const Mat& output, Size personSize, vector<Point>& keypoints, vector<float>* confidences = nullptr) {
+    keypoints.clear();
+    if (confidences != nullptr) {
+        confidences->clear();
+    }
+
+    int H = output.size[2]; // Высота карты
+    int W = output.size[3]; // Ширина карты
+
+    const int NUM_KEYPOINTS = 25;
+    for (int i = 0; i < NUM_KEYPOINTS; ++i) {
+        Mat heatMap(H, W, CV_32F, const_cast<uchar*>(output.ptr(0, i)));
+        Point maxLoc;
+        double maxVal;
+
+        minMaxLoc(heatMap, 0, &maxVal, 0, &maxLoc);
+        if (confidences != nullptr) {
+            confidences->push_back(static_cast<float>(maxVal));
+        }
+
+        if (maxVal > 0.1) { // Уверенность > 0.1
+            keypoints.push_back(Point(static_cast<int>(maxLoc.x * personSize.width / W),
+                static_cast<int>(maxLoc.y * personSize.height / H)));
+        }
+        else {
+            keypoints.push_back(Point(-1, -1));
+        }
+    }
+}
+
+// --- Функция обнаружения ключевых точек тела ---
+vector<Point> detectBodyKeypoints(const Mat& person, Net& net) {
+    vector<Point> keypoints;
+    if (net.empty()) {
+        return keypoints;
+    }
+
+    // Преобразование изображения в формат для модели
+    Mat blob;
+    blobFromImage(person, blob, 1.0 / 255.0, Size(368, 368), Scalar(0, 0, 0), true, false);
+    net.setInput(blob);
+    Mat output = net.forward();
+
+    extractKeypoints(output, person.size(), keypoints);
+    return keypoints;
+}
+
+vector<Point> detectBodyKeypoints(const Mat& person, const string& modelPath, const string& protoPath) {
+    Net net = loadPoseNet(modelPath, protoPath);
+    return detectBodyKeypoints(person, net);
+}
+
+// --- Ключевые точки нескольких людей по полям сродства частей (PAF) ---
+// Выход BODY_25: 25 карт частей тела, карта фона, затем 52 канала PAF (x и y для 26 пар).
+// Пары и номера каналов взяты из OpenPose (POSE_BODY_25_PAIRS и POSE_BODY_25_MAP_IDX).
+const int BODY25_PAIR_COUNT = 26;
+const int body25Pairs[BODY25_PAIR_COUNT][2] = {
+    { 1, 8 }, { 1, 2 }, { 1, 5 }, { 2, 3 }, { 3, 4 }, { 5, 6 }, { 6, 7 }, { 8, 9 }, { 9, 10 }, { 10, 11 },
+    { 8, 12 }, { 12, 13 }, { 13, 14 }, { 1, 0 }, { 0, 15 }, { 15, 17 }, { 0, 16 }, { 16, 18 }, { 2, 17 },
+    { 5, 18 }, { 14, 19 }, { 19, 20 }, { 14, 21 }, { 11, 22 }, { 22, 23 }, { 11, 24 }
+};
+const int body25PafIndex[BODY25_PAIR_COUNT][2] = {
+    { 0, 1 }, { 14, 15 }, { 22, 23 }, { 16, 17 }, { 18, 19 }, { 24, 25 }, { 26, 27 }, { 6, 7 }, { 2, 3 }, { 4, 5 },
+    { 8, 9 }, { 10, 11 }, { 12, 13 }, { 30, 31 }, { 32, 33 }, { 36, 37 }, { 34, 35 }, { 38, 39 }, { 20, 21 },
+    { 28, 29 }, { 40, 41 }, { 42, 43 }, { 44, 45 }, { 46, 47 }, { 48, 49 }, { 50, 51 }
+};
+const int body25PafOffset = 26;
+const int BODY25_OUTPUT_CHANNELS = body25PafOffset + 2 * BODY25_PAIR_COUNT;
+
+// --- Промежуточные выходы сети (ранний выход) ---
+// Слои "Mconv7_stage*", которые выдают только тепловые карты (25 точек + фон), в порядке сети.
+// В моделях с несколькими стадиями тепловых карт ранняя стадия отсекает все последующие.
+// В BODY_25 тепловые карты считаются одной стадией после всех стадий PAF, поэтому выход
+// там один и экономит только склейку с PAF.
+vector<string> findHeatmapExits(Net& net, Size inputSize) {
+    vector<string> exits;
+    MatShape inputShape = { 1, 3, inputSize.height, inputSize.width };
+    for (const string& name : net.getLayerNames()) {
+        if (name.rfind("Mconv7_stage", 0) != 0) {
+            continue;
+        }
+        vector<MatShape> inputShapes, outputShapes;
+        net.getLayerShapes(inputShape, net.getLayerId(name), inputShapes, outputShapes);
+        if (!outputShapes.empty() && outputShapes[0].size() == 4 && outputShapes[0][1] == body25PafOffset) {
+            exits.push_back(name);
+        }
+    }
+    return exits;
+}
+
+// --- Одиночный режим без ветки PAF ---
+// Одному человеку нужны только тепловые карты последней стадии (последний из findHeatmapExits).
+// forward до этого слоя не считает слои после него: в BODY_25 это склейка с PAF (78 каналов),
+// в моделях COCO/MPI - еще и ветка PAF последней стадии. Слои с меньшим номером OpenCV считает
+// всегда, даже если карты от них не зависят, - такие слои только подсчитываются для журнала.
+struct HeatmapBranch {
+    string layer;            // пусто - отсекать нечего или карты не совпали с полной сетью
+    int skippedLayers = 0;   // слои после layer, которые forward(layer) не считает
+    double skippedGflops = 0;
+    int unusedLayers = 0;    // слои до layer, от которых карты не зависят (считаются все равно)
+};
+
+// blob - вход сети нужного размера, для сверки заполняется случайными значениями
+HeatmapBranch findHeatmapBranch(Net& net, const vector<string>& heatmapExits, Mat& blob) {
+    HeatmapBranch branch;
+    if (heatmapExits.empty()) {
+        return branch;
+    }
+    const string& layer = heatmapExits.back();
+    int layerId = net.getLayerId(layer);
+
+    set<int> ancestors = { layerId };
+    vector<int> pending = { layerId };
+    while (!pending.empty()) {
+        int id = pending.back();
+        pending.pop_back();
+        for (const Ptr<Layer>& input : net.getLayerInputs(id)) {
+            int inputId = net.getLayerId(input->name);
+            if (inputId > 0 && ancestors.insert(inputId).second) {
+                pending.push_back(inputId);
+            }
+        }
+    }
+    MatShape inputShape = { blob.size[0], blob.size[1], blob.size[2], blob.size[3] };
+    for (const string& name : net.getLayerNames()) {
+        int id = net.getLayerId(name);
+        if (id > layerId) {
+            ++branch.skippedLayers;
+            branch.skippedGflops += net.getFLOPS(id, inputShape) * 1e-9;
+        }
+        else if (ancestors.count(id) == 0) {
+            ++branch.unusedLayers;
+        }
+    }
+    if (branch.skippedLayers == 0) {
+        return branch;
+    }
+
+    // Сверка: карты слоя должны совпасть с первыми каналами полного выхода (слияние слоев
+    // в OpenCV могло бы подменить промежуточный выход)
+    randu(blob, Scalar(0), Scalar(1));
+    net.setInput(blob);
+    Mat full = net.forward().clone();
+    net.setInput(blob);
+    Mat heatmaps = net.forward(layer);
+    bool sameShape = full.dims == 4 && heatmaps.dims == 4 && full.size[1] >= heatmaps.size[1]
+        && full.size[2] == heatmaps.size[2] && full.size[3] == heatmaps.size[3];
+    if (!sameShape) {
+        logWarn("Тепловые карты слоя %s не совпадают с выходом сети по размеру", layer.c_str());
+        return branch;
+    }
+    int values = static_cast<int>(heatmaps.total());
+    double difference = norm(Mat(1, values, CV_32F, full.ptr<float>()), Mat(1, values, CV_32F, heatmaps.ptr<float>()), NORM_INF);
+    if (difference > 1e-5) {
+        logWarn("Тепловые карты слоя %s отличаются от выхода сети на %g", layer.c_str(), difference);
+        return branch;
+    }
+    branch.layer = layer;
+    return branch;
+}
+
+struct HeatmapPeak {
+    Point2f position;
+    float score;
+};
+
+struct PafConnection {
+    int from;
+    int to;
+    float score;
+};
+
+struct PersonParts {
+    int peak[25];
+    int parts;
+    float score;
+};
+
+// Локальные максимумы карты выше порога (сравнение с 8 соседями)
+void findHeatmapPeaks(const Mat& heatMap, float threshold, vector<HeatmapPeak>& peaks) {
+    peaks.clear();
+    for (int y = 0; y < heatMap.rows; ++y) {
+        const float* row = heatMap.ptr<float>(y);
+        for (int x = 0; x < heatMap.cols; ++x) {
+            float value = row[x];
+            if (value <= threshold) {
+                continue;
+            }
+            bool isPeak = true;
+            for (int dy = -1; dy <= 1 && isPeak; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int ny = y + dy, nx = x + dx;
+                    if ((dx == 0 && dy == 0) || ny < 0 || ny >= heatMap.rows || nx < 0 || nx >= heatMap.cols) {
+                        continue;
+                    }
+                    float neighbor = heatMap.at<float>(ny, nx);
+                    // Для равных значений пик остается только у первого по порядку обхода
+                    if (neighbor > value || (neighbor == value && (dy < 0 || (dy == 0 && dx < 0)))) {
+                        isPeak = false;
+                        break;
+                    }
+                }
+            }
+            if (isPeak) {
+                peaks.push_back({ Point2f(static_cast<float>(x), static_cast<float>(y)), value });
+            }
+        }
+    }
+}
+
+// Средняя проекция PAF на отрезок между двумя пиками; votes - сколько точек отрезка за связь
+float scorePafConnection(const Mat& pafX, const Mat& pafY, Point2f from, Point2f to, int& votes) {
+    const int SAMPLES = 10;
+    Point2f direction = to - from;
+    float length = sqrt(direction.x * direction.x + direction.y * direction.y);
+    votes = 0;
+    if (length < 1e-3f) {
+        return 0.0f;
+    }
+    direction = direction * (1.0 / length);
+
+    float total = 0.0f;
+    for (int i = 0; i < SAMPLES; ++i) {
+        float t = static_cast<float>(i) / (SAMPLES - 1);
+        int x = min(pafX.cols - 1, max(0, static_cast<int>(round(from.x + t * (to.x - from.x)))));
+        int y = min(pafX.rows - 1, max(0, static_cast<int>(round(from.y + t * (to.y - from.y)))));
+        float projection = pafX.at<float>(y, x) * direction.x + pafY.at<float>(y, x) * direction.y;
+        if (projection > 0.05f) {
+            ++votes;
+        }
+        total += projection;
+    }
+    // Штраф за слишком длинные связи (длиннее половины карты)
+    float distancePrior = min(0.5f * pafX.rows / length - 1.0f, 0.0f);
+    return total / SAMPLES + distancePrior;
+}
+
+// Группирует пики всех частей тела в людей за один проход по выходу сети.
+// Для каждого человека - 25 точек в координатах кадра, (-1, -1) если точка не найдена.
+void extractPeopleKeypoints(const Mat& output, Size personSize, vector<vector<Point>>& people) {
+    people.clear();
+    if (output.size[1] < BODY25_OUTPUT_CHANNELS) {
+        logError("В выходе сети нет каналов PAF!");
+        return;
+    }
+
+    int H = output.size[2];
+    int W = output.size[3];
+    const int NUM_KEYPOINTS = 25;
+
+    vector<vector<HeatmapPeak>> peaks(NUM_KEYPOINTS);
+    for (int part = 0; part < NUM_KEYPOINTS; ++part) {
+        Mat heatMap(H, W, CV_32F, const_cast<uchar*>(output.ptr(0, part)));
+        findHeatmapPeaks(heatMap, 0.1f, peaks[part]);
+    }
+
+    vector<PersonParts> candidates;
+    vector<PafConnection> connections;
+    for (int pair = 0; pair < BODY25_PAIR_COUNT; ++pair) {
+        int partA = body25Pairs[pair][0];
+        int partB = body25Pairs[pair][1];
+        Mat pafX(H, W, CV_32F, const_cast<uchar*>(output.ptr(0, body25PafOffset + body25PafIndex[pair][0])));
+        Mat pafY(H, W, CV_32F, const_cast<uchar*>(output.ptr(0, body25PafOffset + body25PafIndex[pair][1])));
+
+        // Все возможные связи пары, лучшие забираются жадно, каждый пик - не больше одной связи
+        connections.clear();
+        for (int i = 0; i < static_cast<int>(peaks[partA].size()); ++i) {
+            for (int j = 0; j < static_cast<int>(peaks[partB].size()); ++j) {
+                int votes = 0;
+                float score = scorePafConnection(pafX, pafY, peaks[partA][i].position, peaks[partB][j].position, votes);
+                if (votes >= 8 && score > 0.0f) {
+                    connections.push_back({ i, j, score });
+                }
+            }
+        }
+        sort(connections.begin(), connections.end(),
+            [](const PafConnection& a, const PafConnection& b) { return a.score > b.score; });
+
+        vector<bool> usedA(peaks[partA].size(), false), usedB(peaks[partB].size(), false);
+        for (const PafConnection& connection : connections) {
+            if (usedA[connection.from] || usedB[connection.to]) {
+                continue;
+            }
+            usedA[connection.from] = usedB[connection.to] = true;
+
+            int found[2] = { -1, -1 };
+            int foundCount = 0;
+            for (int p = 0; p < static_cast<int>(candidates.size()) && foundCount < 2; ++p) {
+                if (candidates[p].peak[partA] == connection.from || candidates[p].peak[partB] == connection.to) {
+                    found[foundCount++] = p;
+                }
+            }
+
+            float pairScore = connection.score + peaks[partB][connection.to].score;
+            if (foundCount == 1) {
+                PersonParts& person = candidates[found[0]];
+                if (person.peak[partB] == -1) {
+                    person.peak[partB] = connection.to;
+                    ++person.parts;
+                    person.score += pairScore;
+                }
+                else if (person.peak[partA] == -1) {
+                    person.peak[partA] = connection.from;
+                    ++person.parts;
+                    person.score += connection.score + peaks[partA][connection.from].score;
+                }
+            }
+            else if (foundCount == 2) {
+                // Две части одного человека нашлись раздельно - объединяем, если они не пересекаются
+                PersonParts& first = candidates[found[0]];
+                PersonParts& second = candidates[found[1]];
+                bool disjoint = true;
+                for (int part = 0; part < NUM_KEYPOINTS; ++part) {
+                    if (first.peak[part] != -1 && second.peak[part] != -1) {
+                        disjoint = false;
+                        break;
+                    }
+                }
+                if (disjoint) {
+                    for (int part = 0; part < NUM_KEYPOINTS; ++part) {
+                        if (second.peak[part] != -1) {
+                            first.peak[part] = second.peak[part];
+                        }
+                    }
+                    first.parts += second.parts;
+                    first.score += second.score + connection.score;
+                    candidates.erase(candidates.begin() + found[1]);
+                }
+            }
+            else if (pair != 18 && pair != 19) {
+                // Пары ухо-плечо избыточны и новых людей не создают (как в OpenPose)
+                PersonParts person;
+                fill(begin(person.peak), end(person.peak), -1);
+                person.peak[partA] = connection.from;
+                person.peak[partB] = connection.to;
+                person.parts = 2;
+                person.score = peaks[partA][connection.from].score + pairScore;
+                candidates.push_back(person);
+            }
+        }
+    }
+
+    for (const PersonParts& person : candidates) {
+        if (person.parts < 4 || person.score / person.parts < 0.2f) {
+            continue;
+        }
+        vector<Point> keypoints(NUM_KEYPOINTS, Point(-1, -1));
+        for (int part = 0; part < NUM_KEYPOINTS; ++part) {
+            if (person.peak[part] != -1) {
+                const Point2f& position = peaks[part][person.peak[part]].position;
+                keypoints[part] = Point(static_cast<int>(position.x * personSize.width / W),
+                    static_cast<int>(position.y * personSize.height / H));
+            }
+        }
+        people.push_back(keypoints);
+    }
+}
+
+// --- Функция вычисления положения и размера майки ---
+Point calculateTshirtPosition(vector<Point>& keypoints, Size tshirtSize) {
+    if (keypoints[1].x == -1 || keypoints[1].y == -1 ||
+        keypoints[2].x == -1 || keypoints[5].x == -1) {
+        logError("Точки шеи или плеч не обнаружены!");
+        engineMetrics.countMissingKeypoints("tshirt");
+        return Point(0, 0);
+    }
+
+    // Изменено: располагем майку выше и по центру между плечами
+    //int x = keypoints[8].y - tshirtSize.width / 2.75; // Центр по тазу
+    int x = ((keypoints[8].x + keypoints[16].x) / 2 - tshirtSize.width / 2); // Центр по тазу
+    int y = keypoints[1].y - tshirtSize.height / 10; // Изменено: выше шеи
+    return Point(x, y);
+}
+
+Size calculateTshirtSize(vector<Point>& keypoints, Size tshirtSize) {
+    if (keypoints[2].x == -1 || keypoints[5].x == -1 ||
+        keypoints[8].x == -1 || keypoints[8].y == -1) {
+        logError("Точки плеч или таза не обнаружены! Используется стандартный размер одежды.");
+        engineMetrics.countMissingKeypoints("tshirt");
+        return tshirtSize;
+    }
+
+    // Изменено: увеличиваем ширину майки
+    int bodyWidth = abs(keypoints[5].x - keypoints[2].x); // Расстояние между плечами
+    int bodyHeight = abs(keypoints[8].y - keypoints[1].y); // Высота от шеи до таза
+
+    if (bodyWidth <= 0 || bodyHeight <= 0) {
+        logError("Некорректные размеры тела! Используется стандартный размер одежды.");
+        return tshirtSize;
+    }
+
+    // Изменено: Увеличил коэффициенты ширины и высоты
+    float scaleFactorWidth = static_cast<float>(bodyWidth) / tshirtSize.width * 2.2; // Изменено: шире на 100%
+    float scaleFactorHeight = static_cast<float>(bodyHeight) / tshirtSize.height * 1.2; // Высота увеличена на 20%
+
+    int newWidth = static_cast<int>(tshirtSize.width * scaleFactorWidth);
+    int newHeight = static_cast<int>(tshirtSize.height * scaleFactorHeight);
+
+    // Граничные проверки (оставил как было)
+    const int minSize = 50;
+    const int maxSize = 1000;
+    newWidth = clamp(newWidth, minSize, maxSize);
+    newHeight = clamp(newHeight, minSize, maxSize);
+
+    return Size(newWidth, newHeight);
+}
+
+// --- Функция вычисления положения и размера штанов ---
+Point calculatePantsPosition(vector<Point>& keypoints, Size pantsSize) {
+    if (keypoints[8].x == -1 || keypoints[8].y == -1 ||
+        keypoints[9].x == -1 || keypoints[12].x == -1) {
+        logError("Точки таза или бедер не обнаружены!");
+        engineMetrics.countMissingKeypoints("pants");
+        return Point(0, 0);
+    }
+
+    // Положение штанов: среднее между центром головы и таза
+    int x = ((keypoints[8].x + keypoints[16].x) / 2 - pantsSize.width / 2);
+    int y = keypoints[8].y * 0.98; // Штаны начинаются от таза
+    return Point(x, y);
+}
+
+Size calculatePantsSize(vector<Point>& keypoints, Size pantsSize) {
+    if (keypoints[9].x == -1 || keypoints[12].x == -1 ||
+        keypoints[10].y == -1 || keypoints[13].y == -1) {
+        logError("Точки бедер или коленей не обнаружены! Используется стандартный размер одежды.");
+        engineMetrics.countMissingKeypoints("pants");
+        return pantsSize;
+    }
+
+    // Ширина штанов: расстояние между бедрами
+    int hipWidth = abs(keypoints[5].x - keypoints[2].x);
+    // Высота штанов: расстояние от таза до коленей
+    int pantsHeight = abs(keypoints[10].y - keypoints[24].y);
+
+    if (hipWidth <= 0 || pantsHeight <= 0) {
+        logError("Некорректные размеры тела! Используется стандартный размер одежды.");
+        return pantsSize;
+    }
+
+    // Коэффициенты ширины и высоты для масштабирования штанов
+    float scaleFactorWidth = static_cast<float>(hipWidth) / pantsSize.width * 1.6; // Увеличение на 130%
+    float scaleFactorHeight = static_cast<float>(pantsHeight) / pantsSize.height * 2; // Увеличение на 130%
+
+    int newWidth = static_cast<int>(pantsSize.width * scaleFactorWidth);
+    int newHeight = static_cast<int>(pantsSize.height * scaleFactorHeight);
+
+    // Граничные проверки
+    const int minSize = 50;
+    const int maxSize = 1000;
+    newWidth = clamp(newWidth, minSize, maxSize);
+    newHeight = clamp(newHeight, minSize, maxSize);
+
+    return Size(newWidth, newHeight);
+}
+
+// --- Функция вычисления положения и размера шляпы ---
+Point calculateHatPosition(vector<Point>& keypoints, Size hatSize) {
+    if (keypoints[0].x == -1 || keypoints[0].y == -1) { // Точка головы
+        logError("Точка головы не обнаружена!");
+        engineMetrics.countMissingKeypoints("hat");
+        return Point(0, 0);
+    }
+
+    int x = keypoints[16].x - hatSize.width / 2; // Центр по голове
+    int y = keypoints[16].y - hatSize.height;   // Над головой
+    return Point(x, y);
+}
+
+Size calculateHatSize(vector<Point>& keypoints, Size hatSize) {
+    if (keypoints[0].x == -1 || keypoints[0].y == -1 || keypoints[1].x == -1 || keypoints[1].y == -1) {
+        logError("Точки головы не обнаружены! Используется стандартный размер шляпы.");
+        engineMetrics.countMissingKeypoints("hat");
+        return hatSize;
+    }
+
+    int headWidth = abs(keypoints[16].x - keypoints[17].x) * 2.5; // Примерная ширина головы
+    float scaleFactor = static_cast<float>(headWidth) / hatSize.width;
+
+    int newWidth = static_cast<int>(hatSize.width * scaleFactor);
+    int newHeight = static_cast<int>(hatSize.height * scaleFactor);
+
+    const int minSize = 50;
+    const int maxSize = 500;
+    newWidth = clamp(newWidth, minSize, maxSize);
+    newHeight = clamp(newHeight, minSize, maxSize);
+
+    return Size(newWidth, newHeight);
+}
+
+// --- Функция вычисления положения и размера очков ---
+Point calculateGlassesPosition(vector<Point>& keypoints, Size glassesSize) {
+    if (keypoints[1].x == -1 || keypoints[1].y == -1 || keypoints[2].x == -1 || keypoints[5].x == -1) {
+        logError("Точки глаз или головы не обнаружены!");
+        engineMetrics.countMissingKeypoints("glasses");
+        return Point(0, 0);
+    }
+
+    int x = (keypoints[0].x + keypoints[18].x) / 2 - glassesSize.width / 2; // Центр между глазами
+    int y = keypoints[18].y - glassesSize.height / 3.5; // Чуть ниже верхней точки головы
+    return Point(x, y);
+}
+
+Size calculateGlassesSize(vector<Point>& keypoints, Size glassesSize) {
+    if (keypoints[1].x == -1 || keypoints[2].x == -1 || keypoints[5].x == -1) {
+        logError("Точки глаз не обнаружены! Используется стандартный размер очков.");
+        engineMetrics.countMissingKeypoints("glasses");
+        return glassesSize;
+    }
+
+    int eyeDistance = abs(keypoints[18].x - keypoints[0].x); // Расстояние между глазами
+    float scaleFactor = static_cast<float>(eyeDistance) / glassesSize.width * 2.2;
+
+    int newWidth = static_cast<int>(glassesSize.width * scaleFactor);
+    int newHeight = static_cast<int>(glassesSize.height * scaleFactor);
+
+    const int minSize = 30;
+    const int maxSize = 300;
+    newWidth = clamp(newWidth, minSize, maxSize);
+    newHeight = clamp(newHeight, minSize, maxSize);
+
+    return Size(newWidth, newHeight);
+}
+
+// --- Таблица правил размещения одежды ---
+// Для каждого типа одежды: функция размера и функция положения по ключевым точкам
+// и сами точки, которые эти функции читают. По anchors решается, хватает ли раннего выхода
+// сети и разрешен ли INT8 для этого типа, поэтому там должны быть все точки, которые читают
+// calculate*Size и calculate*Position.
+// Соответствие проверяет testClothingRuleAnchors в tests/clTestTests.cpp.
+struct ClothingRule {
+    string type;
+    Size(*calculateSize)(vector<Point>&, Size);
+    Point(*calculatePosition)(vector<Point>&, Size);
+    vector<int> anchors;
+};
+
+const vector<ClothingRule> clothingRules = {
+    { "tshirt",  calculateTshirtSize,  calculateTshirtPosition,  { 1, 2, 5, 8, 16 } },
+    { "pants",   calculatePantsSize,   calculatePantsPosition,   { 2, 5, 8, 9, 10, 12, 13, 16, 24 } },
+    { "hat",     calculateHatSize,     calculateHatPosition,     { 0, 1, 16, 17 } },
+    { "glasses", calculateGlassesSize, calculateGlassesPosition, { 0, 1, 2, 5, 18 } },
+};
+
+// Все ли опорные точки правила найдены с уверенностью не ниже threshold
+bool anchorsConfident(const ClothingRule& rule, const vector<float>& confidences, float threshold) {
+    for (int anchor : rule.anchors) {
+        if (anchor >= static_cast<int>(confidences.size()) || confidences[anchor] < threshold) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const ClothingRule* findClothingRule(const string& clothingType) {
+    for (const ClothingRule& rule : clothingRules) {
+        if (rule.type == clothingType) {
+            return &rule;
+        }
+    }
+    return nullptr;
+}
+
+// --- Ожидание группы задач ---
+// Ждущий поток выполняет задачи пула (help), а когда брать нечего - спит до завершения
+// очередной задачи группы, а не крутится на yield: ядро нужно потокам OpenCV DNN.
+// Сигнал подается под мьютексом, и wait возвращается, только взяв его, поэтому группу
+// можно уничтожить сразу после wait (в parallelFor она живет на стеке).
+class CompletionLatch {
+public:
+    void reset(int count) {
+        lock_guard<mutex> lock(latchMutex);
+        remaining = count;
+    }
+
+    void countDown() {
+        lock_guard<mutex> lock(latchMutex);
+        --remaining;
+        ++completions;
+        changed.notify_all();
+    }
+
+    template <class Help>
+    void wait(Help help) {
+        while (true) {
+            unsigned long long seen;
+            {
+                lock_guard<mutex> lock(latchMutex);
+                if (remaining <= 0) {
+                    return;
+                }
+                seen = completions;
+            }
+            if (help()) {
+                continue;
+            }
+            unique_lock<mutex> lock(latchMutex);
+            changed.wait(lock, [&] { return completions != seen; });
+        }
+    }
+
+private:
+    mutex latchMutex;
+    condition_variable changed;
+    int remaining = 0;
+    unsigned long long completions = 0;
+};
+
+// --- Пул потоков с перехватом задач (work-stealing) ---
+// У каждого потока своя очередь: свои задачи берутся с конца, чужие воруются с начала.
+// Поток, ожидающий группу задач, сам выполняет задачи из пула, поэтому вложенные вызовы не блокируются.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threadCount = thread::hardware_concurrency()) {
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+        for (unsigned i = 0; i < threadCount; ++i) {
+            queues.emplace_back(new WorkerQueue());
+        }
+        for (unsigned i = 0; i < threadCount; ++i) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        sleepCondition.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void submit(function<void()> task) {
+        size_t index = (currentWorker >= 0 && currentPool == this)
+            ? static_cast<size_t>(currentWorker)
+            : nextQueue++ % queues.size();
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            ++queuedTasks;
+        }
+        engineMetrics.addQueuedTasks(1);
+        {
+            lock_guard<mutex> lock(queues[index]->m);
+            queues[index]->tasks.push_back(move(task));
+        }
+        sleepCondition.notify_one();
+    }
+
+    // Выполняет одну задачу из пула в текущем потоке, если она есть
+    bool runPendingTask() {
+        function<void()> task;
+        size_t self = (currentWorker >= 0 && currentPool == this) ? static_cast<size_t>(currentWorker) : 0;
+        if (!takeTask(self, task)) {
+            return false;
+        }
+        task();
+        return true;
+    }
+
+    // Запускает body(i) для i в [0, count) и дожидается завершения всех итераций
+    void parallelFor(int count, const function<void(int)>& body) {
+        if (count <= 0) {
+            return;
+        }
+        CompletionLatch done;
+        done.reset(count);
+        for (int i = 0; i < count; ++i) {
+            submit([&body, &done, i] {
+                body(i);
+                done.countDown();
+            });
+        }
+        done.wait([this] { return runPendingTask(); });
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    // Выделения в потоках пула (для AllocationScope запроса)
+    const AllocationGroup& allocations() const {
+        return workerAllocations;
+    }
+
+private:
+    // Кольцевой буфер задач: растет только при переполнении, поэтому после прогрева
+    // постановка задачи не выделяет память (deque выделяет и освобождает блоки на ходу)
+    class TaskRing {
+    public:
+        bool empty() const {
+            return count == 0;
+        }
+
+        void push_back(function<void()> task) {
+            if (count == slots.size()) {
+                grow();
+            }
+            slots[(head + count) % slots.size()] = move(task);
+            ++count;
+        }
+
+        function<void()> pop_back() {
+            --count;
+            return move(slots[(head + count) % slots.size()]);
+        }
+
+        function<void()> pop_front() {
+            function<void()> task = move(slots[head]);
+            head = (head + 1) % slots.size();
+            --count;
+            return task;
+        }
+
+    private:
+        void grow() {
+            vector<function<void()>> larger(max<size_t>(16, slots.size() * 2));
+            for (size_t i = 0; i < count; ++i) {
+                larger[i] = move(slots[(head + i) % slots.size()]);
+            }
+            slots.swap(larger);
+            head = 0;
+        }
+
+        vector<function<void()>> slots;
+        size_t head = 0;
+        size_t count = 0;
+    };
+
+    struct WorkerQueue {
+        mutex m;
+        TaskRing tasks;
+    };
+
+    bool takeTask(size_t self, function<void()>& task) {
+        {
+            lock_guard<mutex> lock(queues[self]->m);
+            if (!queues[self]->tasks.empty()) {
+                task = queues[self]->tasks.pop_back();
+                onTaskTaken();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); ++k) {
+            WorkerQueue& victim = *queues[(self + k) % queues.size()];
+            lock_guard<mutex> lock(victim.m);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.pop_front();
+                onTaskTaken();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void onTaskTaken() {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            --queuedTasks;
+        }
+        engineMetrics.addQueuedTasks(-1);
+    }
+
+    void workerLoop(unsigned index) {
+        currentWorker = static_cast<int>(index);
+        currentPool = this;
+        threadAllocationGroup = &workerAllocations;
+        while (true) {
+            function<void()> task;
+            if (takeTask(index, task)) {
+                task();
+                continue;
+            }
+            unique_lock<mutex> lock(sleepMutex);
+            sleepCondition.wait(lock, [this] { return stopping || queuedTasks > 0; });
+            if (stopping && queuedTasks == 0) {
+                return;
+            }
+        }
+    }
+
+    vector<unique_ptr<WorkerQueue>> queues;
+    AllocationGroup workerAllocations;
+    vector<thread> workers;
+    atomic<size_t> nextQueue{ 0 };
+    mutex sleepMutex;
+    condition_variable sleepCondition;
+    size_t queuedTasks = 0;
+    bool stopping = false;
+
+    static thread_local int currentWorker;
+    static thread_local WorkStealingPool* currentPool;
+};
+
+thread_local int WorkStealingPool::currentWorker = -1;
+thread_local WorkStealingPool* WorkStealingPool::currentPool = nullptr;
+
+// --- Граф задач ---
+// Узел запускается в пуле, когда завершены все его предшественники, так что независимые
+// стадии идут одновременно. Граф строится один раз, run() только сбрасывает счетчики,
+// поэтому повторные запуски не выделяют память.
+class TaskGraph {
+public:
+    int add(function<void()> work, initializer_list<int> dependencies = {}) {
+        int id = static_cast<int>(nodes.size());
+        nodes.emplace_back(new Node());
+        nodes[id]->work = move(work);
+        for (int dependency : dependencies) {
+            nodes[dependency]->successors.push_back(id);
+            ++nodes[id]->dependencyCount;
+        }
+        return id;
+    }
+
+    // Выполняет граф и ждет завершения; вызывающий поток тоже берет задачи из пула.
+    // logId - номер запроса в строках журнала из узлов графа. Если cancel выставлен, еще
+    // не начатые узлы пропускаются (начатые доделываются) - отмена на границе стадий.
+    void run(WorkStealingPool& executor, long long logId = 0, const atomic<bool>* cancel = nullptr) {
+        pool = &executor;
+        runLogId = logId;
+        runCancel = cancel;
+        cancelled = false;
+        for (unique_ptr<Node>& node : nodes) {
+            node->pending = node->dependencyCount;
+        }
+        done.reset(static_cast<int>(nodes.size()));
+        for (unique_ptr<Node>& node : nodes) {
+            if (node->dependencyCount == 0) {
+                schedule(node.get());
+            }
+        }
+        done.wait([this] { return pool->runPendingTask(); });
+    }
+
+    // Пропустил ли последний run хотя бы один узел из-за отмены
+    bool wasCancelled() const {
+        return cancelled.load();
+    }
+
+private:
+    struct Node {
+        function<void()> work;
+        vector<int> successors;
+        int dependencyCount = 0;
+        atomic<int> pending{ 0 };
+    };
+
+    // Захватываются только два указателя - задача помещается в function без выделения памяти
+    void schedule(Node* node) {
+        pool->submit([this, node] {
+            LogRequestScope scope(runLogId);
+            if (runCancel != nullptr && runCancel->load()) {
+                cancelled = true;
+            }
+            else {
+                node->work();
+            }
+            for (int successor : node->successors) {
+                if (--nodes[successor]->pending == 0) {
+                    schedule(nodes[successor].get());
+                }
+            }
+            done.countDown();
+        });
+    }
+
+    vector<unique_ptr<Node>> nodes;
+    WorkStealingPool* pool = nullptr;
+    long long runLogId = 0;
+    const atomic<bool>* runCancel = nullptr;
+    atomic<bool> cancelled{ false };
+    CompletionLatch done;
+};
+
+// --- Прогрессивная выдача результата ---
+// Сначала отдается предпросмотр (длинная сторона previewMaxSide), затем полный кадр.
+const int previewMaxSide = 720;
+const double previewBudgetMs = 50.0;
+// Уровень RenderTier::Reduced: длинная сторона фото перед примеркой
+const int reducedTierMaxSide = 1280;
+// Кадр прокрутки карусели должен успеть за один кадр экрана
+const double scrubBudgetMs = 16.0;
+
+// Flutter читает stdout построчно: "<событие> <данные>", обычно данные - путь к файлу
+// Нагрузочный тест выключает события, чтобы десятки движков не засоряли stdout.
+atomic<bool> eventsEnabled{ true };
+
+void emitEvent(const string& event, const string& payload) {
+    if (!eventsEnabled.load()) {
+        return;
+    }
+    static mutex outputMutex;
+    lock_guard<mutex> lock(outputMutex);
+    cout << event << " " << payload << endl;
+}
+
+// Запись через временный файл, чтобы Flutter никогда не прочитал недописанный JPEG
+bool writeImageAtomically(const string& path, const Mat& image, int jpegQuality) {
+    string tmpPath = path + ".tmp.jpg";
+    if (!imwrite(tmpPath, image, { IMWRITE_JPEG_QUALITY, jpegQuality })) {
+        logError("Не удалось сохранить изображение: %s", path.c_str());
+        return false;
+    }
+    remove(path.c_str());
+    if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+        logError("Не удалось переименовать файл: %s", tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// --- Вывод кадра в общую память для текстуры Flutter (Linux) ---
+// Плагин linux/result_texture_plugin.cc отображает этот сегмент и отдает кадр
+// в FlPixelBufferTexture без кодирования в JPEG и без файлов.
+// Раскладка: заголовок 64 байта, затем три слота RGBA по slotCapacity байт (тройной буфер).
+// В state два номера слота: биты 0-1 - последний готовый кадр, биты 2-3 - слот, который
+// читает плагин (sharedFrameNoSlot - никакой). Плагин забирает последний кадр, атомарно
+// записывая его номер в слот читателя; движок пишет только в третий слот, не последний
+// и не читаемый, и публикует его сменой последнего. Поэтому кадр, который Flutter еще
+// загружает в текстуру, никогда не перезаписывается. Сегмент удаляется при выходе движка:
+// плагин подключается к нему, пока движок жив (--serve).
+struct SharedFrameHeader {
+    uint32_t magic;
+    uint32_t slotCapacity;
+    uint32_t width[3];
+    uint32_t height[3];
+    uint32_t state;
+    uint32_t sequence;
+};
+
+const uint32_t sharedFrameMagic = 0x334D464F; // "OFM3"
+const size_t sharedFrameHeaderSize = 64;
+const uint32_t sharedFrameSlotCount = 3;
+const uint32_t sharedFrameNoSlot = 3;
+const uint32_t sharedFrameSlotCapacity = 4096u * 4096u * 4u;
+
+class SharedFrameWriter {
+public:
+    ~SharedFrameWriter() {
+#ifdef __linux__
+        if (mapping != nullptr) {
+            munmap(mapping, mappingSize);
+            shm_unlink(segmentName.c_str());
+        }
+#endif
+    }
+
+    bool open(const string& name) {
+#ifdef __linux__
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd < 0) {
+            logError("Не удалось открыть общую память: %s", name.c_str());
+            return false;
+        }
+        mappingSize = sharedFrameHeaderSize + sharedFrameSlotCount * static_cast<size_t>(sharedFrameSlotCapacity);
+        if (ftruncate(fd, static_cast<off_t>(mappingSize)) != 0) {
+            logError("Не удалось задать размер общей памяти: %s", name.c_str());
+            close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED) {
+            logError("Не удалось отобразить общую память: %s", name.c_str());
+            return false;
+        }
+        mapping = static_cast<uchar*>(address);
+        segmentName = name;
+        header()->slotCapacity = sharedFrameSlotCapacity;
+        __atomic_store_n(&header()->state, sharedFrameNoSlot | (sharedFrameNoSlot << 2), __ATOMIC_RELEASE);
+        __atomic_store_n(&header()->magic, sharedFrameMagic, __ATOMIC_RELEASE);
+        return true;
+#else
+        logError("Вывод в текстуру поддерживается только на Linux: %s", name.c_str());
+        return false;
+#endif
+    }
+
+    // Переводит BGR кадр в RGBA прямо в свободный слот и публикует его
+    bool publish(const Mat& frame) {
+        if (mapping == nullptr || frame.empty()) {
+            return false;
+        }
+        if (static_cast<size_t>(frame.cols) * frame.rows * 4 > sharedFrameSlotCapacity) {
+            logError("Кадр слишком большой для текстуры: %dx%d", frame.cols, frame.rows);
+            return false;
+        }
+#ifdef __linux__
+        // Плагин может сменить только слот читателя и только на последний кадр,
+        // поэтому выбранный слот остается свободным до публикации
+        uint32_t state = __atomic_load_n(&header()->state, __ATOMIC_ACQUIRE);
+        uint32_t slot = 0;
+        while (slot == (state & 3) || slot == ((state >> 2) & 3)) {
+            ++slot;
+        }
+        Mat target(frame.rows, frame.cols, CV_8UC4, mapping + sharedFrameHeaderSize + slot * static_cast<size_t>(sharedFrameSlotCapacity));
+        cvtColor(frame, target, COLOR_BGR2RGBA);
+        header()->width[slot] = static_cast<uint32_t>(frame.cols);
+        header()->height[slot] = static_cast<uint32_t>(frame.rows);
+        while (!__atomic_compare_exchange_n(&header()->state, &state, (state & ~3u) | slot, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        }
+        __atomic_add_fetch(&header()->sequence, 1, __ATOMIC_RELEASE);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+    SharedFrameHeader* header() {
+        return reinterpret_cast<SharedFrameHeader*>(mapping);
+    }
+
+    uchar* mapping = nullptr;
+    size_t mappingSize = 0;
+    string segmentName;
+};
+
+// --- Сжатое хранение одежды ---
+// Резидентный каталог на тысячи вещей в BGRA занимает гигабайты на каждый движок. Сжатая вещь
+// хранится блоками 4x4 по 16 байт (раскладка как у BC2/DXT3): 8 байт 4-битной альфы, два опорных
+// цвета RGB565 и по 2 бита на пиксель - выбор из опорных цветов и двух промежуточных.
+// Это 1 байт на пиксель вместо 4. Целиком вещь не распаковывается: масштабирование под человека
+// распаковывает только те строки источника, которые читает билинейная интерполяция
+// (resizePackedGarment); сравнение с несжатой одеждой - --bench-packing.
+const int PACKED_BLOCK_BYTES = 16;
+
+struct PackedGarment {
+    Size size;
+    vector<uint8_t> blocks; // ряды блоков сверху вниз, в ряду слева направо
+};
+
+// Вещь в кэше или каталоге: либо BGRA как есть, либо сжатая. Копия, как и у Mat, делит данные,
+// поэтому перенос вещи в новый снимок каталога ничего не копирует.
+struct StoredGarment {
+    Mat image;
+    shared_ptr<const PackedGarment> packed;
+
+    bool empty() const {
+        return image.empty() && !packed;
+    }
+
+    size_t residentBytes() const {
+        return !image.empty() ? image.total() * image.elemSize() : packed ? packed->blocks.size() : 0;
+    }
+
+    Size size() const {
+        return !image.empty() ? image.size() : packed ? packed->size : Size();
+    }
+};
+
+uint16_t packRgb565(const Vec3i& color) {
+    return static_cast<uint16_t>(((color[2] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[0] * 31 + 127) / 255));
+}
+
+// Цвет в порядке BGR, как в кадре
+Vec3i unpackRgb565(uint16_t packed) {
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    return Vec3i((b << 3) | (b >> 2), (g << 2) | (g >> 4), (r << 3) | (r >> 2));
+}
+
+void blockPalette(uint16_t first, uint16_t second, Vec3i palette[4]) {
+    palette[0] = unpackRgb565(first);
+    palette[1] = unpackRgb565(second);
+    for (int c = 0; c < 3; ++c) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+}
+
+// Опорные цвета - углы рамки цветов видимых пикселей, чуть сдвинутые внутрь (как в быстрых
+// кодировщиках DXT); прозрачные пиксели на выбор цветов не влияют
+void packBlock(const Mat& image, int blockX, int blockY, uint8_t* block) {
+    Vec4b pixels[16];
+    for (int i = 0; i < 16; ++i) {
+        int x = min(blockX * 4 + i % 4, image.cols - 1);
+        int y = min(blockY * 4 + i / 4, image.rows - 1);
+        pixels[i] = image.at<Vec4b>(y, x);
+    }
+
+    Vec3i low(255, 255, 255), high(0, 0, 0);
+    bool visible = false;
+    for (int i = 0; i < 16; ++i) {
+        int alpha = (pixels[i][3] * 15 + 127) / 255;
+        block[i / 2] = static_cast<uint8_t>(i % 2 == 0 ? alpha : block[i / 2] | alpha << 4);
+        if (alpha == 0) {
+            continue;
+        }
+        visible = true;
+        for (int c = 0; c < 3; ++c) {
+            low[c] = min(low[c], static_cast<int>(pixels[i][c]));
+            high[c] = max(high[c], static_cast<int>(pixels[i][c]));
+        }
+    }
+    if (!visible) {
+        low = high = Vec3i(0, 0, 0);
+    }
+    for (int c = 0; c < 3; ++c) {
+        int inset = (high[c] - low[c]) / 16;
+        low[c] += inset;
+        high[c] -= inset;
+    }
+
+    uint16_t first = packRgb565(high), second = packRgb565(low);
+    memcpy(block + 8, &first, 2);
+    memcpy(block + 10, &second, 2);
+    Vec3i palette[4];
+    blockPalette(first, second, palette);
+    for (int i = 0; i < 4; ++i) {
+        block[12 + i] = 0;
+    }
+    for (int i = 0; i < 16; ++i) {
+        int best = 0, bestDistance = INT_MAX;
+        for (int p = 0; p < 4; ++p) {
+            int distance = 0;
+            for (int c = 0; c < 3; ++c) {
+                int d = pixels[i][c] - palette[p][c];
+                distance += d * d;
+            }
+            if (distance < bestDistance) {
+                best = p;
+                bestDistance = distance;
+            }
+        }
+        block[12 + i / 4] |= static_cast<uint8_t>(best << (2 * (i % 4)));
+    }
+}
+
+PackedGarment packGarment(const Mat& image) {
+    PackedGarment packed;
+    packed.size = image.size();
+    int blocksX = (image.cols + 3) / 4, blocksY = (image.rows + 3) / 4;
+    packed.blocks.resize(static_cast<size_t>(blocksX) * blocksY * PACKED_BLOCK_BYTES);
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            packBlock(image, bx, by, &packed.blocks[(static_cast<size_t>(by) * blocksX + bx) * PACKED_BLOCK_BYTES]);
+        }
+    }
+    return packed;
+}
+
+// Строка y (0..3) блока: columns пикселей BGRA в row
+void unpackBlockRow(const uint8_t* block, int y, int columns, Vec4b* row) {
+    uint16_t first, second;
+    memcpy(&first, block + 8, 2);
+    memcpy(&second, block + 10, 2);
+    Vec3i palette[4];
+    blockPalette(first, second, palette);
+    for (int x = 0; x < columns; ++x) {
+        int i = y * 4 + x;
+        const Vec3i& color = palette[(block[12 + y] >> (2 * x)) & 3];
+        int alpha = (block[i / 2] >> (4 * (i % 2))) & 15;
+        row[x] = Vec4b(static_cast<uchar>(color[0]), static_cast<uchar>(color[1]), static_cast<uchar>(color[2]),
+            static_cast<uchar>(alpha * 17));
+    }
+}
+
+// Одна строка y вещи (packed.size.width пикселей) в row
+void unpackGarmentRow(const PackedGarment& packed, int y, Vec4b* row) {
+    const int blocksX = (packed.size.width + 3) / 4;
+    const uint8_t* blocks = &packed.blocks[static_cast<size_t>(y / 4) * blocksX * PACKED_BLOCK_BYTES];
+    for (int bx = 0; bx < blocksX; ++bx) {
+        unpackBlockRow(blocks + bx * PACKED_BLOCK_BYTES, y % 4, min(4, packed.size.width - bx * 4), row + bx * 4);
+    }
+}
+
+class UnpackGarmentBody : public ParallelLoopBody {
+public:
+    UnpackGarmentBody(const PackedGarment& packed, Mat& image) : packed(packed), image(image) {}
+
+    void operator()(const Range& range) const override {
+        for (int y = range.start * 4; y < min(packed.size.height, range.end * 4); ++y) {
+            unpackGarmentRow(packed, y, image.ptr<Vec4b>(y));
+        }
+    }
+
+private:
+    const PackedGarment& packed;
+    Mat& image;
+};
+
+// image - готовый буфер BGRA размера packed.size
+void unpackGarment(const PackedGarment& packed, Mat& image) {
+    parallel_for_(Range(0, (packed.size.height + 3) / 4), UnpackGarmentBody(packed, image));
+}
+
+// Билинейное масштабирование сжатой вещи (как resize с INTER_LINEAR) полосами строк item.
+// У каждой полосы две строки буфера rows: распаковываются только строки источника, которые
+// читает интерполяция, а соседние строки item переиспользуют уже распакованные.
+const int PACKED_RESIZE_STRIPES = 8;
+
+class ResizePackedGarmentBody : public ParallelLoopBody {
+public:
+    ResizePackedGarmentBody(const PackedGarment& packed, Mat& item, Mat& rows, int stripeHeight)
+        : packed(packed), item(item), rows(rows), stripeHeight(stripeHeight) {}
+
+    void operator()(const Range& range) const override {
+        const Size source = packed.size;
+        const float scaleX = static_cast<float>(source.width) / item.cols;
+        const float scaleY = static_cast<float>(source.height) / item.rows;
+        for (int stripe = range.start; stripe < range.end; ++stripe) {
+            Vec4b* slots[2] = { rows.ptr<Vec4b>(stripe * 2), rows.ptr<Vec4b>(stripe * 2 + 1) };
+            int cached[2] = { -1, -1 };
+            // Строка y источника в одном из двух слотов полосы; слот со строкой keep не занимается
+            auto sourceRow = [&](int y, int keep) -> const Vec4b* {
+                for (int s = 0; s < 2; ++s) {
+                    if (cached[s] == y) {
+                        return slots[s];
+                    }
+                }
+                int s = cached[0] == keep ? 1 : 0;
+                unpackGarmentRow(packed, y, slots[s]);
+                cached[s] = y;
+                return slots[s];
+            };
+
+            for (int dy = stripe * stripeHeight; dy < min(item.rows, (stripe + 1) * stripeHeight); ++dy) {
+                float sy = max(0.f, (dy + 0.5f) * scaleY - 0.5f);
+                int y0 = min(static_cast<int>(sy), source.height - 1);
+                int y1 = min(y0 + 1, source.height - 1);
+                float wy = sy - y0;
+                const Vec4b* top = sourceRow(y0, y1);
+                const Vec4b* bottom = sourceRow(y1, y0);
+                Vec4b* out = item.ptr<Vec4b>(dy);
+                for (int dx = 0; dx < item.cols; ++dx) {
+                    float sx = max(0.f, (dx + 0.5f) * scaleX - 0.5f);
+                    int x0 = min(static_cast<int>(sx), source.width - 1);
+                    int x1 = min(x0 + 1, source.width - 1);
+                    float wx = sx - x0;
+                    for (int c = 0; c < 4; ++c) {
+                        float upper = top[x0][c] + (top[x1][c] - top[x0][c]) * wx;
+                        float lower = bottom[x0][c] + (bottom[x1][c] - bottom[x0][c]) * wx;
+                        out[dx][c] = saturate_cast<uchar>(upper + (lower - upper) * wy);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    const PackedGarment& packed;
+    Mat& item;
+    Mat& rows;
+    int stripeHeight;
+};
+
+// item - готовый буфер BGRA нужного размера, rowArena - арена строк источника
+void resizePackedGarment(const PackedGarment& packed, Mat& item, Mat& rowArena) {
+    int stripes = min(PACKED_RESIZE_STRIPES, item.rows);
+    Mat rows = arenaView(rowArena, Size(packed.size.width, 2 * stripes), CV_8UC4);
+    parallel_for_(Range(0, stripes), ResizePackedGarmentBody(packed, item, rows, (item.rows + stripes - 1) / stripes));
+}
+
+// Масштабирует вещь в готовый буфер item; сжатая вещь при этом распаковывается по строкам
+void resizeGarment(const StoredGarment& garment, Mat& item, Mat& rowArena) {
+    if (garment.packed) {
+        resizePackedGarment(*garment.packed, item, rowArena);
+    }
+    else {
+        resize(garment.image, item, item.size());
+    }
+}
+
+StoredGarment storeGarment(const Mat& image, bool compress) {
+    StoredGarment stored;
+    if (compress) {
+        stored.packed = make_shared<const PackedGarment>(packGarment(image));
+    }
+    else {
+        stored.image = image;
+    }
+    return stored;
+}
+
+// --- Наложение одной вещи на нескольких людей ---
+struct GarmentPlacement {
+    Point location;
+    Size size;
+};
+
+// Масштабирует одежду для каждого человека параллельно (каждому свой буфер из арены,
+// сжатой вещи - еще и своя арена строк источника)
+class ResizeGarmentsBody : public ParallelLoopBody {
+public:
+    ResizeGarmentsBody(const StoredGarment& garment, vector<Mat>& items, vector<Mat>& rowArenas)
+        : garment(garment), items(items), rowArenas(rowArenas) {}
+
+    void operator()(const Range& range) const override {
+        for (int i = range.start; i < range.end; ++i) {
+            resizeGarment(garment, items[i], rowArenas[i]);
+        }
+    }
+
+private:
+    const StoredGarment& garment;
+    vector<Mat>& items;
+    vector<Mat>& rowArenas;
+};
+
+// Смешивает кадр полосами строк; внутри полосы люди обрабатываются по порядку,
+// поэтому перекрывающиеся вещи дают тот же результат, что и последовательное наложение
+class BlendGarmentsBody : public ParallelLoopBody {
+public:
+    BlendGarmentsBody(Mat& frame, const vector<GarmentPlacement>& placements, double scale, const vector<Mat>& items, int stripeHeight)
+        : frame(frame), placements(placements), scale(scale), items(items), stripeHeight(stripeHeight) {}
+
+    void operator()(const Range& range) const override {
+        Range rows(range.start * stripeHeight, min(frame.rows, range.end * stripeHeight));
+        for (size_t i = 0; i < placements.size(); ++i) {
+            Point location(static_cast<int>(placements[i].location.x * scale), static_cast<int>(placements[i].location.y * scale));
+            blendResizedItem(frame, items[i], location, rows);
+        }
+    }
+
+private:
+    Mat& frame;
+    const vector<GarmentPlacement>& placements;
+    double scale;
+    const vector<Mat>& items;
+    int stripeHeight;
+};
+
+// --- Многополосное смешивание (пирамиды Лапласа) только в окрестности одежды ---
+// Убирает резкий край "вклеенной" одежды. Пирамиды строятся по расширенному
+// прямоугольнику вещи, а не по всему кадру, буферы пирамид переиспользуются.
+enum class BlendMode {
+    Alpha,
+    MultiBand
+};
+
+const int multiBandLevels = 4;
+const double multiBandBudgetMs = 25.0;
+
+struct PyramidScratch {
+    enum Kind { FOREGROUND, BACKGROUND, MASK, UPSAMPLED, BLENDED, KIND_COUNT };
+
+    Mat view(Kind kind, int level, Size size, int type) {
+        return arenaView(arenas[kind * (multiBandLevels + 1) + level], size, type);
+    }
+
+    vector<Mat> arenas = vector<Mat>(KIND_COUNT * (multiBandLevels + 1));
+    double nsPerPixel = 0.0; // скользящая оценка стоимости, нужна для прогноза бюджета
+};
+
+// Прямоугольник, по которому строятся пирамиды: вещь плюс запас на размытие нижних уровней
+Rect multiBandRoi(const Mat& frame, const Mat& item, Point location) {
+    const int margin = 2 << multiBandLevels;
+    Rect roi(location.x - margin, location.y - margin, item.cols + 2 * margin, item.rows + 2 * margin);
+    return roi & Rect(0, 0, frame.cols, frame.rows);
+}
+
+bool blendMultiBand(Mat& frame, const Mat& item, Point location, PyramidScratch& scratch) {
+    Rect roi = multiBandRoi(frame, item, location);
+    if (roi.empty()) {
+        return true;
+    }
+
+    int levels = multiBandLevels;
+    while (levels > 0 && (min(roi.width, roi.height) >> levels) < 4) {
+        --levels;
+    }
+
+    // Уровень 0: фон, фон с одеждой (без учета прозрачности) и маска прозрачности
+    Mat background = scratch.view(PyramidScratch::BACKGROUND, 0, roi.size(), CV_32FC3);
+    Mat foreground = scratch.view(PyramidScratch::FOREGROUND, 0, roi.size(), CV_32FC3);
+    Mat mask = scratch.view(PyramidScratch::MASK, 0, roi.size(), CV_32FC1);
+    frame(roi).convertTo(background, CV_32F);
+    background.copyTo(foreground);
+    mask.setTo(Scalar::all(0));
+
+    Rect itemInRoi = Rect(location - roi.tl(), item.size()) & Rect(Point(0, 0), roi.size());
+    for (int y = itemInRoi.y; y < itemInRoi.y + itemInRoi.height; ++y) {
+        const Vec4b* itemRow = item.ptr<Vec4b>(y + roi.y - location.y);
+        Vec3f* fgRow = foreground.ptr<Vec3f>(y);
+        float* maskRow = mask.ptr<float>(y);
+        for (int x = itemInRoi.x; x < itemInRoi.x + itemInRoi.width; ++x) {
+            const Vec4b& pixel = itemRow[x + roi.x - location.x];
+            if (pixel[3] == 0) {
+                continue;
+            }
+            fgRow[x] = Vec3f(pixel[0], pixel[1], pixel[2]);
+            maskRow[x] = pixel[3] / 255.0f;
+        }
+    }
+
+    // Гауссовы пирамиды
+    Size sizes[multiBandLevels + 1];
+    sizes[0] = roi.size();
+    for (int i = 1; i <= levels; ++i) {
+        sizes[i] = Size((sizes[i - 1].width + 1) / 2, (sizes[i - 1].height + 1) / 2);
+        Mat fgDown = scratch.view(PyramidScratch::FOREGROUND, i, sizes[i], CV_32FC3);
+        Mat bgDown = scratch.view(PyramidScratch::BACKGROUND, i, sizes[i], CV_32FC3);
+        Mat maskDown = scratch.view(PyramidScratch::MASK, i, sizes[i], CV_32FC1);
+        pyrDown(scratch.view(PyramidScratch::FOREGROUND, i - 1, sizes[i - 1], CV_32FC3), fgDown, sizes[i]);
+        pyrDown(scratch.view(PyramidScratch::BACKGROUND, i - 1, sizes[i - 1], CV_32FC3), bgDown, sizes[i]);
+        pyrDown(scratch.view(PyramidScratch::MASK, i - 1, sizes[i - 1], CV_32FC1), maskDown, sizes[i]);
+    }
+
+    // Лапласовы уровни на месте гауссовых и смешивание каждого уровня по своей маске
+    for (int i = 0; i <= levels; ++i) {
+        Mat fg = scratch.view(PyramidScratch::FOREGROUND, i, sizes[i], CV_32FC3);
+        Mat bg = scratch.view(PyramidScratch::BACKGROUND, i, sizes[i], CV_32FC3);
+        if (i < levels) {
+            Mat up = scratch.view(PyramidScratch::UPSAMPLED, i, sizes[i], CV_32FC3);
+            pyrUp(scratch.view(PyramidScratch::FOREGROUND, i + 1, sizes[i + 1], CV_32FC3), up, sizes[i]);
+            subtract(fg, up, fg);
+            pyrUp(scratch.view(PyramidScratch::BACKGROUND, i + 1, sizes[i + 1], CV_32FC3), up, sizes[i]);
+            subtract(bg, up, bg);
+        }
+        Mat levelMask = scratch.view(PyramidScratch::MASK, i, sizes[i], CV_32FC1);
+        Mat blended = scratch.view(PyramidScratch::BLENDED, i, sizes[i], CV_32FC3);
+        for (int y = 0; y < sizes[i].height; ++y) {
+            const Vec3f* fgRow = fg.ptr<Vec3f>(y);
+            const Vec3f* bgRow = bg.ptr<Vec3f>(y);
+            const float* maskRow = levelMask.ptr<float>(y);
+            Vec3f* outRow = blended.ptr<Vec3f>(y);
+            for (int x = 0; x < sizes[i].width; ++x) {
+                float m = maskRow[x];
+                for (int c = 0; c < 3; ++c) {
+                    outRow[x][c] = m * fgRow[x][c] + (1.0f - m) * bgRow[x][c];
+                }
+            }
+        }
+    }
+
+    // Сборка пирамиды обратно и запись в кадр
+    for (int i = levels - 1; i >= 0; --i) {
+        Mat up = scratch.view(PyramidScratch::UPSAMPLED, i, sizes[i], CV_32FC3);
+        pyrUp(scratch.view(PyramidScratch::BLENDED, i + 1, sizes[i + 1], CV_32FC3), up, sizes[i]);
+        Mat blended = scratch.view(PyramidScratch::BLENDED, i, sizes[i], CV_32FC3);
+        add(blended, up, blended);
+    }
+    Mat target = frame(roi);
+    scratch.view(PyramidScratch::BLENDED, 0, sizes[0], CV_32FC3).convertTo(target, CV_8U);
+    return true;
+}
+
+// Одна инференция дает N поз, затем N дешевых наложений: масштабирование вещей и
+// смешивание полос кадра идут параллельно. scale переводит размещение в масштаб кадра.
+// В режиме MultiBand каждая вещь смешивается пирамидами, пока укладываемся в бюджет
+// multiBandBudgetMs; если прогноз по площади его превышает, вещь смешивается обычной альфой.
+bool compositeGarment(Mat& frame, const StoredGarment& garment, const vector<GarmentPlacement>& placements, double scale,
+    vector<Mat>& itemArenas, vector<Mat>& items, vector<Mat>& rowArenas, BlendMode mode = BlendMode::Alpha,
+    PyramidScratch* scratch = nullptr) {
+    if (frame.empty() || garment.empty()) {
+        logError("Одно из изображений пустое!");
+        return false;
+    }
+    if (!garment.image.empty() && garment.image.channels() != 4) {
+        logError("Изображение одежды должно иметь 4 канала (RGBA)!");
+        return false;
+    }
+
+    if (itemArenas.size() < placements.size()) {
+        itemArenas.resize(placements.size());
+    }
+    if (rowArenas.size() < placements.size()) {
+        rowArenas.resize(placements.size());
+    }
+    items.resize(placements.size());
+    for (size_t i = 0; i < placements.size(); ++i) {
+        Size size(max(1, static_cast<int>(placements[i].size.width * scale)), max(1, static_cast<int>(placements[i].size.height * scale)));
+        items[i] = arenaView(itemArenas[i], size, CV_8UC4);
+    }
+
+    int count = static_cast<int>(placements.size());
+    parallel_for_(Range(0, count), ResizeGarmentsBody(garment, items, rowArenas));
+
+    if (mode == BlendMode::MultiBand && scratch != nullptr) {
+        TickMeter budgetTimer;
+        budgetTimer.start();
+        bool degraded = false;
+        for (int i = 0; i < count; ++i) {
+            Point location(static_cast<int>(placements[i].location.x * scale), static_cast<int>(placements[i].location.y * scale));
+            double roiPixels = multiBandRoi(frame, items[i], location).area();
+            budgetTimer.stop();
+            double elapsedMs = budgetTimer.getTimeMilli();
+            budgetTimer.start();
+            if (elapsedMs + roiPixels * scratch->nsPerPixel / 1e6 > multiBandBudgetMs) {
+                blendResizedItem(frame, items[i], location, Range(0, frame.rows));
+                degraded = true;
+                continue;
+            }
+
+            TickMeter blendTimer;
+            blendTimer.start();
+            blendMultiBand(frame, items[i], location, *scratch);
+            blendTimer.stop();
+            if (roiPixels > 0) {
+                double measured = blendTimer.getTimeMilli() * 1e6 / roiPixels;
+                scratch->nsPerPixel = scratch->nsPerPixel == 0.0 ? measured : 0.8 * scratch->nsPerPixel + 0.2 * measured;
+            }
+        }
+        if (degraded) {
+            logWarn("Бюджет многополосного смешивания превышен, использовано обычное наложение");
+        }
+        return true;
+    }
+
+    const int stripeHeight = 64;
+    int stripes = (frame.rows + stripeHeight - 1) / stripeHeight;
+    parallel_for_(Range(0, stripes), BlendGarmentsBody(frame, placements, scale, items, stripeHeight));
+    return true;
+}
+
+// --- Подготовка входа сети одним проходом ---
+// blobFromImage(image, 1/255, size, 0, swapRB=true) после resize еще несколько раз проходит по
+// уменьшенному кадру: перестановка каналов, перевод в float с масштабом и раскладка HWC -> NCHW.
+// Здесь уменьшение делает тот же resize INTER_LINEAR (векторный, из OpenCV) в буфер, который
+// переиспользуется между запросами, а все остальное - один векторный проход по строкам
+// уменьшенного кадра, пока он в кэше: разбор BGR на каналы, 8 -> 32 бита, масштаб 1/255 и
+// запись R и B сразу в свои плоскости. Строки делятся между потоками. Результат совпадает
+// с blobFromImage, сверка и сравнение времени - --check-blob.
+struct BlobScratch {
+    Mat resized; // кадр в размере входа сети, 8UC3
+};
+
+class FusedBlobBody : public ParallelLoopBody {
+public:
+    FusedBlobBody(const Mat& resized, Mat& blob, int item)
+        : resized(resized), blob(blob), item(item) {}
+
+    void operator()(const Range& range) const override {
+        const int width = resized.cols;
+        const int stride = blob.size[3];
+        const float norm = 1.0f / 255.0f;
+        // Источник BGR, вход сети RGB: канал c пишется в плоскость 2 - c
+        float* planes[3] = { blob.ptr<float>(item, 2), blob.ptr<float>(item, 1), blob.ptr<float>(item, 0) };
+        for (int y = range.start; y < range.end; ++y) {
+            const uchar* source = resized.ptr<uchar>(y);
+            float* rows[3] = { planes[0] + y * stride, planes[1] + y * stride, planes[2] + y * stride };
+            int x = 0;
+#if CV_SIMD
+            const v_float32 scale = vx_setall_f32(norm);
+            for (; x <= width - v_uint8::nlanes; x += v_uint8::nlanes) {
+                v_uint8 b, g, r;
+                v_load_deinterleave(source + 3 * x, b, g, r);
+                storeScaled(b, rows[0] + x, scale);
+                storeScaled(g, rows[1] + x, scale);
+                storeScaled(r, rows[2] + x, scale);
+            }
+#endif
+            for (; x < width; ++x) {
+                for (int c = 0; c < 3; ++c) {
+                    rows[c][x] = source[3 * x + c] * norm;
+                }
+            }
+        }
+    }
+
+private:
+#if CV_SIMD
+    // 8 бит -> float * scale, nlanes байт в четыре вектора float подряд
+    static void storeScaled(const v_uint8& value, float* out, const v_float32& scale) {
+        const int step = v_float32::nlanes;
+        v_uint16 low, high;
+        v_expand(value, low, high);
+        v_uint32 part0, part1, part2, part3;
+        v_expand(low, part0, part1);
+        v_expand(high, part2, part3);
+        v_store(out, v_cvt_f32(v_reinterpret_as_s32(part0)) * scale);
+        v_store(out + step, v_cvt_f32(v_reinterpret_as_s32(part1)) * scale);
+        v_store(out + 2 * step, v_cvt_f32(v_reinterpret_as_s32(part2)) * scale);
+        v_store(out + 3 * step, v_cvt_f32(v_reinterpret_as_s32(part3)) * scale);
+    }
+#endif
+
+    const Mat& resized;
+    Mat& blob;
+    int item;
+};
+
+// blob уже создан (Nx3xHxW, CV_32F). Кадр пишется в элемент item, в левый верхний угол размера
+// target (по умолчанию - весь элемент); остальное не трогается. Кадры не BGR 8 бит идут через
+// обычный blobFromImage и поддерживаются только целиком в первый элемент.
+void fusedBlobFromImage(const Mat& image, Mat& blob, BlobScratch& scratch, int item = 0, Size target = Size()) {
+    if (target.area() == 0) {
+        target = Size(blob.size[3], blob.size[2]);
+    }
+    if (image.type() != CV_8UC3) {
+        blobFromImage(image, blob, 1.0 / 255.0, target, Scalar(0, 0, 0), true, false);
+        return;
+    }
+    resize(image, scratch.resized, target, 0, 0, INTER_LINEAR);
+    parallel_for_(Range(0, target.height), FusedBlobBody(scratch.resized, blob, item));
+}
+
+// --- Каталог одежды ---
+// Файл каталога: в каждой строке путь к картинке (относительно проекта) и тип одежды.
+struct CatalogEntry {
+    string path;
+    string type;
+};
+
+vector<CatalogEntry> loadCatalog(const string& catalogPath) {
+    vector<CatalogEntry> catalog;
+    ifstream catalogFile(catalogPath);
+    if (!catalogFile.is_open()) {
+        logError("Не удалось открыть каталог: %s", catalogPath.c_str());
+        return catalog;
+    }
+    CatalogEntry entry;
+    while (catalogFile >> entry.path >> entry.type) {
+        catalog.push_back(entry);
+    }
+    return catalog;
+}
+
+// --- Горячая перезагрузка каталога ---
+// Каталог и картинки одежды готовятся в фоне и публикуются целиком как новый снимок
+// (эпоха). Запрос берет снимок в начале и держит его до конца, поэтому всегда видит
+// согласованный каталог; старый снимок освобождается, когда его отпустит последний запрос.
+// Изменения ловятся через inotify (Linux), на других системах - опросом времени изменения файлов.
+struct CatalogGarment {
+    StoredGarment garment;
+    fs::file_time_type modified;
+};
+
+struct CatalogSnapshot {
+    long long epoch = 0;
+    vector<CatalogEntry> entries;
+    map<string, CatalogGarment> garments; // ключ - нормализованный полный путь (catalogKey)
+};
+
+string catalogKey(const fs::path& path) {
+    return path.lexically_normal().generic_string();
+}
+
+class CatalogWatcher {
+public:
+    CatalogWatcher() = default;
+    CatalogWatcher(const CatalogWatcher&) = delete;
+    CatalogWatcher& operator=(const CatalogWatcher&) = delete;
+
+    ~CatalogWatcher() {
+        stop();
+    }
+
+    // Пути в каталоге считаются от rootDir (как в catalog.txt проекта);
+    // compress - хранить вещи сжатыми (см. PackedGarment)
+    bool start(const string& catalogFilePath, const string& rootDir, bool compress = false) {
+        catalogPath = catalogFilePath;
+        root = rootDir;
+        compressGarments = compress;
+        if (!rebuild()) {
+            return false;
+        }
+#ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0 || pipe(stopPipe) != 0) {
+            logError("inotify недоступен, каталог будет опрашиваться");
+            if (inotifyFd >= 0) {
+                ::close(inotifyFd);
+                inotifyFd = -1;
+            }
+        }
+#endif
+        watcher = thread([this] { watchLoop(); });
+        return true;
+    }
+
+    void stop() {
+        if (!watcher.joinable()) {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(stopMutex);
+            stopping = true;
+        }
+        stopCondition.notify_all();
+#ifdef __linux__
+        if (inotifyFd >= 0) {
+            char wake = 1;
+            ssize_t written = write(stopPipe[1], &wake, 1);
+            (void)written;
+        }
+#endif
+        watcher.join();
+#ifdef __linux__
+        if (inotifyFd >= 0) {
+            ::close(inotifyFd);
+            ::close(stopPipe[0]);
+            ::close(stopPipe[1]);
+            inotifyFd = -1;
+        }
+#endif
+    }
+
+    shared_ptr<const CatalogSnapshot> snapshot() const {
+        return atomic_load(&current);
+    }
+
+private:
+    // Новый снимок: неизмененные картинки переносятся из текущего, остальные читаются заново
+    bool rebuild() {
+        vector<CatalogEntry> entries = loadCatalog(catalogPath);
+        if (entries.empty()) {
+            return false;
+        }
+        shared_ptr<const CatalogSnapshot> previous = snapshot();
+        shared_ptr<CatalogSnapshot> next = make_shared<CatalogSnapshot>();
+        next->epoch = previous ? previous->epoch + 1 : 1;
+        next->entries = entries;
+        int reloaded = 0;
+        unsigned long long residentBytes = 0;
+        for (const CatalogEntry& entry : entries) {
+            fs::path path = fs::path(root) / entry.path;
+            string key = catalogKey(path);
+            error_code error;
+            fs::file_time_type modified = fs::last_write_time(path, error);
+            if (error) {
+                logError("Нет файла одежды из каталога: %s", path.string().c_str());
+                continue;
+            }
+            if (previous) {
+                auto old = previous->garments.find(key);
+                if (old != previous->garments.end() && old->second.modified == modified) {
+                    next->garments.emplace(key, old->second);
+                    residentBytes += old->second.garment.residentBytes();
+                    continue;
+                }
+            }
+            StageTimer timer(Stage::Decode);
+            Mat image = imread(path.string(), IMREAD_UNCHANGED);
+            if (image.empty() || image.channels() != 4) {
+                logError("Одежда должна быть картинкой с 4 каналами (RGBA): %s", path.string().c_str());
+                continue;
+            }
+            CatalogGarment garment{ storeGarment(image, compressGarments), modified };
+            residentBytes += garment.garment.residentBytes();
+            next->garments.emplace(key, move(garment));
+            ++reloaded;
+        }
+        atomic_store(&current, shared_ptr<const CatalogSnapshot>(next));
+        engineMetrics.setCatalogBytes(residentBytes);
+        logInfo("Каталог: эпоха %lld, вещей %zu, перечитано %d, в памяти %llu байт",
+            next->epoch, next->entries.size(), reloaded, residentBytes);
+        emitEvent("catalog", to_string(next->epoch) + " " + to_string(next->entries.size()) + " " + to_string(reloaded));
+        return true;
+    }
+
+    // Папки, за которыми надо следить: папка каталога и папки всех картинок
+    set<string> watchedDirectories() const {
+        set<string> directories;
+        directories.insert(catalogKey(fs::absolute(fs::path(catalogPath)).parent_path()));
+        shared_ptr<const CatalogSnapshot> catalog = snapshot();
+        if (catalog) {
+            for (const CatalogEntry& entry : catalog->entries) {
+                directories.insert(catalogKey((fs::path(root) / entry.path).parent_path()));
+            }
+        }
+        return directories;
+    }
+
+    // Отпечаток для опроса: время изменения каталога и всех картинок
+    string pollSignature() const {
+        string signature;
+        vector<fs::path> files = { fs::path(catalogPath) };
+        shared_ptr<const CatalogSnapshot> catalog = snapshot();
+        if (catalog) {
+            for (const CatalogEntry& entry : catalog->entries) {
+                files.push_back(fs::path(root) / entry.path);
+            }
+        }
+        for (const fs::path& file : files) {
+            error_code error;
+            signature += to_string(fs::last_write_time(file, error).time_since_epoch().count()) + ";";
+        }
+        return signature;
+    }
+
+    void watchLoop() {
+#ifdef __linux__
+        if (inotifyFd >= 0) {
+            watchWithInotify();
+            return;
+        }
+#endif
+        // Опрос раз в 2 секунды
+        string signature = pollSignature();
+        unique_lock<mutex> lock(stopMutex);
+        while (!stopCondition.wait_for(lock, chrono::seconds(2), [this] { return stopping; })) {
+            string latest = pollSignature();
+            if (latest != signature) {
+                lock.unlock();
+                rebuild();
+                signature = pollSignature();
+                lock.lock();
+            }
+        }
+    }
+
+#ifdef __linux__
+    void watchWithInotify() {
+        const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM;
+        for (const string& directory : watchedDirectories()) {
+            inotify_add_watch(inotifyFd, directory.c_str(), mask);
+        }
+        // Изменения копятся, пока 300 мс подряд нет новых событий (копирование пачки файлов)
+        const int debounceMs = 300;
+        bool pending = false;
+        char buffer[4096];
+        while (true) {
+            pollfd descriptors[2] = { { inotifyFd, POLLIN, 0 }, { stopPipe[0], POLLIN, 0 } };
+            int ready = poll(descriptors, 2, pending ? debounceMs : -1);
+            if (descriptors[1].revents & POLLIN) {
+                return;
+            }
+            if (ready > 0 && (descriptors[0].revents & POLLIN)) {
+                while (read(inotifyFd, buffer, sizeof(buffer)) > 0) {
+                }
+                pending = true;
+                continue;
+            }
+            if (ready == 0 && pending) {
+                pending = false;
+                rebuild();
+                // В каталоге могли появиться новые папки
+                for (const string& directory : watchedDirectories()) {
+                    inotify_add_watch(inotifyFd, directory.c_str(), mask);
+                }
+            }
+        }
+    }
+
+    int inotifyFd = -1;
+    int stopPipe[2] = { -1, -1 };
+#endif
+
+    string catalogPath;
+    string root;
+    bool compressGarments = false;
+    shared_ptr<const CatalogSnapshot> current;
+    thread watcher;
+    mutex stopMutex;
+    condition_variable stopCondition;
+    bool stopping = false;
+};
+
+// --- Стек слоев сеанса ---
+// Кадр сеанса - исходное фото и слои одежды снизу вверх. Замена, добавление или удаление
+// слоя пересобирает только прямоугольники, которые слой занимал и занимает теперь: в них
+// кадр восстанавливается из исходного фото и заново смешиваются слои, задевающие прямоугольник.
+// Стоимость правки пропорциональна площади одежды, а не размеру фото.
+struct LayerPiece {
+    Mat item;       // одежда после resize (BGRA)
+    Point location; // левый верхний угол в кадре
+};
+
+struct GarmentLayer {
+    string type;
+    int depth;
+    vector<LayerPiece> pieces; // по куску на человека
+};
+
+// Порядок слоев снизу вверх; неизвестные типы ложатся сверху
+int layerDepth(const string& clothingType) {
+    const char* const order[] = { "pants", "tshirt", "glasses", "hat" };
+    for (int i = 0; i < 4; ++i) {
+        if (clothingType == order[i]) {
+            return i;
+        }
+    }
+    return 4;
+}
+
+class LayerStack {
+public:
+    void reset(const Mat& photo) {
+        photo.copyTo(base);
+        base.copyTo(frame);
+        layers.clear();
+    }
+
+    bool empty() const {
+        return base.empty();
+    }
+
+    const Mat& composite() const {
+        return frame;
+    }
+
+    // Добавляет слой или заменяет слой того же типа; возвращает площадь пересобранной области
+    long long setLayer(const string& type, vector<LayerPiece> pieces) {
+        dirty.clear();
+        auto existing = findLayer(type);
+        if (existing != layers.end()) {
+            markDirty(*existing);
+            existing->pieces = move(pieces);
+            markDirty(*existing);
+        }
+        else {
+            GarmentLayer layer{ type, layerDepth(type), move(pieces) };
+            markDirty(layer);
+            auto position = find_if(layers.begin(), layers.end(),
+                [&layer](const GarmentLayer& other) { return other.depth > layer.depth; });
+            layers.insert(position, move(layer));
+        }
+        return redraw();
+    }
+
+    // Убирает слой; false, если такого слоя нет
+    bool removeLayer(const string& type, long long& redrawnPixels) {
+        dirty.clear();
+        auto existing = findLayer(type);
+        if (existing == layers.end()) {
+            return false;
+        }
+        markDirty(*existing);
+        layers.erase(existing);
+        redrawnPixels = redraw();
+        return true;
+    }
+
+private:
+    vector<GarmentLayer>::iterator findLayer(const string& type) {
+        return find_if(layers.begin(), layers.end(), [&type](const GarmentLayer& layer) { return layer.type == type; });
+    }
+
+    void markDirty(const GarmentLayer& layer) {
+        for (const LayerPiece& piece : layer.pieces) {
+            Rect area = Rect(piece.location, piece.item.size()) & Rect(0, 0, frame.cols, frame.rows);
+            if (area.area() > 0) {
+                dirty.push_back(area);
+            }
+        }
+    }
+
+    // Пересекающиеся прямоугольники сливаются, чтобы не смешивать одни и те же пиксели дважды
+    void mergeDirty() {
+        for (bool merged = true; merged;) {
+            merged = false;
+            for (size_t i = 0; i < dirty.size() && !merged; ++i) {
+                for (size_t j = i + 1; j < dirty.size(); ++j) {
+                    if ((dirty[i] & dirty[j]).area() > 0) {
+                        dirty[i] |= dirty[j];
+                        dirty.erase(dirty.begin() + j);
+                        merged = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    long long redraw() {
+        mergeDirty();
+        long long pixels = 0;
+        for (const Rect& area : dirty) {
+            Mat region = frame(area);
+            base(area).copyTo(region);
+            for (const GarmentLayer& layer : layers) {
+                for (const LayerPiece& piece : layer.pieces) {
+                    if ((Rect(piece.location, piece.item.size()) & area).area() > 0) {
+                        blendResizedItem(region, piece.item, piece.location - area.tl(), Range(0, region.rows));
+                    }
+                }
+            }
+            pixels += area.area();
+        }
+        return pixels;
+    }
+
+    Mat base;  // исходное фото
+    Mat frame; // текущий кадр со всеми слоями
+    vector<GarmentLayer> layers; // снизу вверх
+    vector<Rect> dirty;
+};
+
+// --- Буферы рабочего потока ---
+// Все промежуточные Mat запроса живут здесь и переиспользуются между запросами.
+struct WorkerBuffers {
+    Mat frameArena;    // полный кадр результата
+    Mat previewArena;  // кадр предпросмотра
+    Mat reducedArena;  // фото запроса на уровне RenderTier::Reduced
+    vector<Mat> itemArenas; // одежда после resize, по арене на человека
+    vector<Mat> items;      // заголовки поверх itemArenas
+    vector<Mat> itemRowArenas; // строки сжатой одежды при масштабировании, по арене на человека
+    vector<Mat> previewItemArenas; // то же для предпросмотра, он смешивается одновременно с полным кадром
+    vector<Mat> previewItems;
+    vector<Mat> previewItemRowArenas;
+    BlobScratch blobScratch; // уменьшенный кадр для входа сети 368x368
+    Mat scrubArena;    // кадр прокрутки карусели
+    Mat garmentArena;  // распакованная сжатая одежда для карусели
+    Mat garment;       // заголовок поверх garmentArena
+    Mat blob;          // 1x3x368x368
+    Mat netOutput;
+    Mat batchBlob;     // Nx3xSxS - все масштабы точного режима
+    vector<BlobScratch> batchScratch; // уменьшенный кадр каждого масштаба
+    Mat fusedOutput;   // 1xCxHxW - усредненные тепловые карты масштабов
+    Mat scaledHeatmap; // карта одного масштаба, растянутая до общего размера
+    Mat detectInput;          // уменьшенный кадр для поиска человека
+    vector<Rect> personBoxes; // рамки людей от детектора
+    vector<Point> keypoints;
+    vector<float> confidences;            // уверенность каждой точки (для раннего выхода)
+    vector<vector<Point>> people;         // ключевые точки каждого человека в режиме нескольких людей
+    vector<GarmentPlacement> placements;  // куда и какого размера накладывать одежду на каждого
+    PyramidScratch pyramids;              // буферы многополосного смешивания
+};
+
+// --- Дорожка поз видео ---
+// Ключевые точки каждого кадра сохраняются рядом с видео, чтобы перерисовывать его с новой
+// одеждой без сети. Формат (little-endian): "OMPT", версия, число точек, ширина и высота кадра,
+// fps; затем на каждый кадр число людей и по каждой точке байт уверенности (0 - точка не
+// найдена), а для найденной точки - смещения x и y от последнего известного положения той же
+// точки того же человека (zigzag varint). Люди в соседних кадрах сопоставляются по порядку.
+const char poseTrackMagic[4] = { 'O', 'M', 'P', 'T' };
+const uint16_t poseTrackVersion = 1;
+const int poseTrackKeypoints = 25;
+
+struct PoseFrame {
+    vector<vector<Point>> people;      // по 25 точек на человека, (-1, -1) - точка не найдена
+    vector<vector<float>> confidences; // уверенность каждой точки
+};
+
+string poseTrackPath(const string& videoPath) {
+    return videoPath + ".pose";
+}
+
+void writeVarint(ostream& out, int value) {
+    uint32_t zigzag = (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    while (zigzag >= 0x80) {
+        out.put(static_cast<char>((zigzag & 0x7F) | 0x80));
+        zigzag >>= 7;
+    }
+    out.put(static_cast<char>(zigzag));
+}
+
+bool readVarint(istream& in, int& value) {
+    uint32_t zigzag = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int byte = in.get();
+        if (byte == EOF) {
+            return false;
+        }
+        zigzag |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            value = static_cast<int>(zigzag >> 1) ^ -static_cast<int>(zigzag & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+void writeRaw(ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool readRaw(istream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+// Пишет во временный файл; на место дорожка встает только после close(), поэтому
+// оборванный проход не оставляет неполную дорожку под именем готовой
+class PoseTrackWriter {
+public:
+    bool open(const string& trackPath, Size frameSize, double fps) {
+        path = trackPath;
+        tmpPath = trackPath + ".tmp";
+        out.open(tmpPath, ios::binary | ios::trunc);
+        if (!out.is_open()) {
+            logError("Не удалось создать дорожку поз: %s", tmpPath.c_str());
+            return false;
+        }
+        out.write(poseTrackMagic, sizeof(poseTrackMagic));
+        writeRaw(out, poseTrackVersion);
+        writeRaw(out, static_cast<uint16_t>(poseTrackKeypoints));
+        writeRaw(out, static_cast<int32_t>(frameSize.width));
+        writeRaw(out, static_cast<int32_t>(frameSize.height));
+        writeRaw(out, fps);
+        return true;
+    }
+
+    void write(const PoseFrame& pose) {
+        uint8_t count = static_cast<uint8_t>(min<size_t>(pose.people.size(), 255));
+        writeRaw(out, count);
+        if (previous.size() < count) {
+            previous.resize(count, vector<Point>(poseTrackKeypoints, Point(0, 0)));
+        }
+        for (int person = 0; person < count; ++person) {
+            const vector<Point>& keypoints = pose.people[person];
+            const vector<float>* confidences = person < static_cast<int>(pose.confidences.size()) ? &pose.confidences[person] : nullptr;
+            for (int i = 0; i < poseTrackKeypoints; ++i) {
+                Point point = i < static_cast<int>(keypoints.size()) ? keypoints[i] : Point(-1, -1);
+                if (point.x < 0 || point.y < 0) {
+                    writeRaw(out, static_cast<uint8_t>(0));
+                    continue;
+                }
+                float confidence = confidences != nullptr && i < static_cast<int>(confidences->size()) ? (*confidences)[i] : 1.0f;
+                writeRaw(out, static_cast<uint8_t>(min(255, max(1, cvRound(confidence * 255)))));
+                writeVarint(out, point.x - previous[person][i].x);
+                writeVarint(out, point.y - previous[person][i].y);
+                previous[person][i] = point;
+            }
+        }
+    }
+
+    bool close() {
+        out.close();
+        if (out.fail()) {
+            logError("Не удалось записать дорожку поз: %s", tmpPath.c_str());
+            return false;
+        }
+        remove(path.c_str());
+        if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+            logError("Не удалось переименовать файл: %s", tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    ofstream out;
+    string path;
+    string tmpPath;
+    vector<vector<Point>> previous; // последнее известное положение каждой точки каждого человека
+};
+
+class PoseTrackReader {
+public:
+    bool open(const string& trackPath) {
+        in.open(trackPath, ios::binary);
+        char magic[4] = {};
+        uint16_t version = 0, keypointCount = 0;
+        int32_t width = 0, height = 0;
+        if (!in.is_open() || !in.read(magic, sizeof(magic)) || memcmp(magic, poseTrackMagic, sizeof(magic)) != 0 ||
+            !readRaw(in, version) || !readRaw(in, keypointCount) || !readRaw(in, width) || !readRaw(in, height) || !readRaw(in, fps)) {
+            logError("Не удалось прочитать дорожку поз: %s", trackPath.c_str());
+            return false;
+        }
+        if (version != poseTrackVersion || keypointCount != poseTrackKeypoints) {
+            logError("Неподдерживаемая дорожка поз (версия %d, точек %d): %s", version, keypointCount, trackPath.c_str());
+            return false;
+        }
+        frameSize = Size(width, height);
+        return true;
+    }
+
+    // false в конце дорожки или если кадр оборван
+    bool read(PoseFrame& pose) {
+        uint8_t count = 0;
+        if (!readRaw(in, count)) {
+            return false;
+        }
+        if (previous.size() < count) {
+            previous.resize(count, vector<Point>(poseTrackKeypoints, Point(0, 0)));
+        }
+        pose.people.resize(count);
+        pose.confidences.resize(count);
+        for (int person = 0; person < count; ++person) {
+            vector<Point>& keypoints = pose.people[person];
+            vector<float>& confidences = pose.confidences[person];
+            keypoints.assign(poseTrackKeypoints, Point(-1, -1));
+            confidences.assign(poseTrackKeypoints, 0.0f);
+            for (int i = 0; i < poseTrackKeypoints; ++i) {
+                uint8_t confidence = 0;
+                if (!readRaw(in, confidence)) {
+                    return false;
+                }
+                if (confidence == 0) {
+                    continue;
+                }
+                int dx = 0, dy = 0;
+                if (!readVarint(in, dx) || !readVarint(in, dy)) {
+                    return false;
+                }
+                previous[person][i] += Point(dx, dy);
+                keypoints[i] = previous[person][i];
+                confidences[i] = confidence / 255.0f;
+            }
+        }
+        return true;
+    }
+
+    Size frameSize;
+    double fps = 0;
+
+private:
+    ifstream in;
+    vector<vector<Point>> previous;
+};
+
+// --- INT8-вариант сети ---
+// OpenCV не сохраняет квантованную сеть в файл, поэтому калибровка (--calibrate-int8) пишет
+// список фото, по которым движок квантует сеть при загрузке, и типы одежды, для которых
+// отчет точности разрешил INT8. Формат файла - строки через табуляцию:
+//   photo <путь к фото>
+//   type <тип одежды> <1 - INT8 разрешен, 0 - нет>
+struct Int8Calibration {
+    vector<string> photos;
+    vector<string> approvedTypes;
+};
+
+bool readInt8Calibration(const string& path, Int8Calibration& calibration) {
+    ifstream in(path);
+    if (!in.is_open()) {
+        logError("Не удалось открыть файл калибровки INT8: %s", path.c_str());
+        return false;
+    }
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        istringstream fields(line);
+        string kind, value, approved;
+        getline(fields, kind, '\t');
+        getline(fields, value, '\t');
+        getline(fields, approved, '\t');
+        if (kind == "photo" && !value.empty()) {
+            calibration.photos.push_back(value);
+        }
+        else if (kind == "type" && approved == "1") {
+            calibration.approvedTypes.push_back(value);
+        }
+    }
+    if (calibration.photos.empty()) {
+        logError("В файле калибровки INT8 нет фото: %s", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Вход сети 368x368 для фото калибровки, тот же, что готовит prepareInputBlob
+bool calibrationBlob(const string& photoPath, Mat& blob, BlobScratch& scratch, Size* photoSize = nullptr) {
+    Mat photo = imread(photoPath);
+    if (photo.empty()) {
+        logError("Не удалось загрузить изображение: %s", photoPath.c_str());
+        return false;
+    }
+    const int inputSizes[] = { 1, 3, 368, 368 };
+    blob.create(4, inputSizes, CV_32F);
+    fusedBlobFromImage(photo, blob, scratch);
+    if (photoSize != nullptr) {
+        *photoSize = photo.size();
+    }
+    return true;
+}
+
+// Квантует сеть по фото калибровки (масштабы активаций берутся из прогона float-сети по ним).
+// Вход и выход остаются float32, поэтому квантованная сеть подменяет обычную без других изменений.
+Net quantizePoseNet(Net& net, const vector<string>& photos) {
+    StageTimer timer(Stage::ModelLoad);
+    vector<Mat> blobs;
+    BlobScratch scratch;
+    for (const string& photo : photos) {
+        Mat blob;
+        if (calibrationBlob(photo, blob, scratch)) {
+            blobs.push_back(blob);
+        }
+    }
+    if (blobs.empty()) {
+        logError("Нет ни одного фото для калибровки INT8");
+        return Net();
+    }
+    Net quantized = net.quantize(blobs, CV_32F, CV_32F);
+    if (quantized.empty()) {
+        logError("Не удалось квантовать сеть");
+    }
+    return quantized;
+}
+
+// Номера запросов для журнала, общие для всех движков процесса
+atomic<long long> nextLogRequestId{ 0 };
+
+// Масштабы точного режима: 1, 1 - scaleGap, ... (не больше scaleCount, все больше 0)
+vector<double> precisionScaleList(int scaleCount, double scaleGap) {
+    vector<double> scales;
+    for (int i = 0; i < scaleCount && 1.0 - i * scaleGap > 0.0; ++i) {
+        scales.push_back(1.0 - i * scaleGap);
+    }
+    return scales;
+}
+
+// --- Движок примерки ---
+// Держит модель, кэш одежды и буферы между запросами, поэтому прогретый запрос
+// не выделяет память в вычислительной части (см. lastRequestAllocations).
+class TryOnEngine {
+public:
+    TryOnEngine() : pool(2) {
+        buildRequestGraph();
+        peopleDetector.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
+    }
+
+    bool load(const string& modelPath, const string& protoPath) {
+        net = loadPoseNet(modelPath, protoPath);
+        if (net.empty()) {
+            return false;
+        }
+        const int inputSizes[] = { 1, 3, 368, 368 };
+        buffers.blob.create(4, inputSizes, CV_32F);
+        buffers.keypoints.reserve(25);
+        buffers.confidences.reserve(25);
+        heatmapExits = findHeatmapExits(net, Size(inputSizes[3], inputSizes[2]));
+        HeatmapBranch branch = findHeatmapBranch(net, heatmapExits, buffers.blob);
+        heatmapLayer = branch.layer;
+        if (!heatmapLayer.empty()) {
+            logInfo("Один человек: выход %s, не считается слоев %d (%.2f GFLOP), лишних до него %d",
+                heatmapLayer.c_str(), branch.skippedLayers, branch.skippedGflops, branch.unusedLayers);
+        }
+        return true;
+    }
+
+    // Ранний выход: тепловые карты берутся из промежуточного слоя layer ("auto" - самый ранний),
+    // полная сеть считается, только если опорные точки одежды уверенней threshold не нашлись.
+    // В режиме нескольких людей не действует - там нужны PAF с конца сети.
+    bool setEarlyExit(const string& layer, float threshold) {
+        string chosen = layer == "auto" && !heatmapExits.empty() ? heatmapExits.front() : layer;
+        if (find(heatmapExits.begin(), heatmapExits.end(), chosen) == heatmapExits.end()) {
+            logError("Слой не выдает тепловые карты: %s", layer.c_str());
+            return false;
+        }
+        earlyExitLayer = chosen;
+        earlyExitThreshold = threshold;
+        return true;
+    }
+
+    // INT8-вариант сети по файлу калибровки (--calibrate-int8): квантуется при загрузке и
+    // считается только для одежды, чьи опорные точки в отчете точности остались в допуске.
+    // Не действует в режиме нескольких людей (PAF не проверялись) и в точном режиме.
+    bool setInt8(const string& calibrationPath) {
+        Int8Calibration calibration;
+        if (!readInt8Calibration(calibrationPath, calibration)) {
+            return false;
+        }
+        int8Net = quantizePoseNet(net, calibration.photos);
+        if (int8Net.empty()) {
+            return false;
+        }
+        int8Types = calibration.approvedTypes;
+        if (int8Types.empty()) {
+            logWarn("Калибровка INT8 не разрешила ни одного типа одежды: %s", calibrationPath.c_str());
+        }
+        return true;
+    }
+
+    // Точный режим (как у OpenPose): фото подается в scaleCount масштабах (1, 1 - scaleGap, ...)
+    // на квадрате side. Масштабы упакованы в один пакет Nx3xSxS (меньшие дополнены серым), сеть
+    // считается одним forward, тепловые карты каждого масштаба растягиваются до общего размера
+    // и усредняются перед поиском точек. scaleCount 1 - обычный режим 368x368.
+    // Пакет считает N полных квадратов side x side; выгоднее ли он N forward по очереди,
+    // показывает --bench-precision.
+    void setPrecision(int scaleCount, int side, double scaleGap = 0.25) {
+        precisionScales = precisionScaleList(scaleCount, scaleGap);
+        if (precisionScales.size() < 2) {
+            precisionScales.clear();
+            return;
+        }
+        const int batchSizes[] = { static_cast<int>(precisionScales.size()), 3, side, side };
+        buffers.batchBlob.create(4, batchSizes, CV_32F);
+        buffers.batchScratch.resize(precisionScales.size());
+    }
+
+    // Прогревочные проходы сети на пустом входе: первый forward в OpenCV DNN
+    // намного медленнее (выделение буферов слоев, выбор реализаций)
+    void warmUp(int runs) {
+        Mat& input = precisionScales.empty() ? buffers.blob : buffers.batchBlob;
+        input.setTo(Scalar(0));
+        for (int i = 0; i < runs; ++i) {
+            StageTimer timer(Stage::Warmup);
+            net.setInput(input);
+            buffers.netOutput = net.forward();
+            if (!int8Net.empty() && precisionScales.empty()) {
+                int8Net.setInput(input);
+                buffers.netOutput = int8Net.forward();
+            }
+        }
+    }
+
+    // Один запрос примерки; время, исход и выделения попадают в engineMetrics
+    // tier - уровень исполнения, который выбрал планировщик сервера под срок запроса.
+    // preview = false - без предпросмотра перед полным кадром (пакетные запросы: их можно вытеснить
+    // и выполнить заново, и клиент получил бы предпросмотр дважды); на уровне PreviewOnly он все равно есть.
+    bool processRequest(const Mat& person, const string& clothPath, const string& clothingType,
+        RenderTier tier = RenderTier::Full, bool preview = true) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Mat input = person;
+        if (tier == RenderTier::Reduced) {
+            double scale = 1.0;
+            Size reducedSize = scaledSizeForMaxSide(person.size(), reducedTierMaxSide, scale);
+            if (scale < 1.0) {
+                input = arenaView(buffers.reducedArena, reducedSize, person.type());
+                resize(person, input, reducedSize, 0, 0, INTER_AREA);
+            }
+        }
+        bool ok = runRequest(input, clothPath, clothingType, true, nullptr, tier == RenderTier::PreviewOnly,
+            preview || tier == RenderTier::PreviewOnly);
+        if (preempted) {
+            return false; // запрос выполнится заново, в метрики попадет тогда
+        }
+        engineMetrics.observeRequest(clothingType, ok,
+            chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), lastAllocations);
+        return ok;
+    }
+
+    // Только полный кадр, без предпросмотра и записи (пакетный режим, видео). Кадр лежит
+    // в арене движка и действителен до следующего запроса. pose - готовые ключевые точки
+    // из дорожки поз: сеть не считается и может быть даже не загружена.
+    bool renderFullFrame(const Mat& person, const string& clothPath, const string& clothingType, Mat& output,
+        const PoseFrame* pose = nullptr) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool ok = runRequest(person, clothPath, clothingType, false, pose);
+        if (ok) {
+            output = request.output;
+        }
+        engineMetrics.observeRequest(clothingType, ok,
+            chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), lastAllocations);
+        return ok;
+    }
+
+    // --- Сеанс примерки образа ---
+    // Ключевые точки фото считаются один раз, дальше вещи добавляются, заменяются и
+    // снимаются слоями (см. LayerStack); после каждой правки выдается результат.
+    bool beginSession(const Mat& person) {
+        if (person.empty()) {
+            logError("Пустое изображение человека!");
+            return false;
+        }
+        detectKeypoints(person, nullptr);
+        if (buffers.placements.empty()) {
+            logError("Не удалось обнаружить ключевые точки!");
+            return false;
+        }
+        sessionKeypoints = buffers.keypoints;
+        sessionPeople = buffers.people;
+        layers.reset(person);
+        scrubGarments.clear();
+        scrubBase.release();
+        return deliverFrame("result", resultFileName, layers.composite(), 95);
+    }
+
+    // --- Прокрутка карусели ---
+    // Кадр в разрешении экрана: текущий образ сеанса (уменьшенный один раз) и вещь в фокусе поверх.
+    // Вещь масштабируется под позу сеанса один раз и дальше берется готовой, поэтому кадр -
+    // это копия фона, смешивание небольшой картинки и выдача (бюджет scrubBudgetMs).
+    bool scrubTo(const string& clothPath, const string& clothingType) {
+        if (layers.empty()) {
+            logError("Сеанс не начат!");
+            return false;
+        }
+        TickMeter scrubTimer;
+        scrubTimer.start();
+        if (scrubBase.empty()) {
+            Size displaySize = scaledSizeForMaxSide(layers.composite().size(), previewMaxSide, scrubScale);
+            resize(layers.composite(), scrubBase, displaySize, 0, 0, INTER_AREA);
+        }
+        const ScrubGarment* garment = scrubGarment(clothPath, clothingType);
+        if (garment == nullptr) {
+            return false;
+        }
+        Mat frame = arenaView(buffers.scrubArena, scrubBase.size(), scrubBase.type());
+        scrubBase.copyTo(frame);
+        for (size_t i = 0; i < garment->items.size(); ++i) {
+            blendResizedItem(frame, garment->items[i], garment->locations[i], Range(0, frame.rows));
+        }
+        bool ok = deliverFrame("scrub", scrubFileName, frame, 80);
+        scrubTimer.stop();
+        engineMetrics.observeStage(Stage::Scrub, scrubTimer.getTimeMilli());
+        if (scrubTimer.getTimeMilli() > scrubBudgetMs) {
+            logWarn("Кадр прокрутки занял %g мс (бюджет %g мс)", scrubTimer.getTimeMilli(), scrubBudgetMs);
+        }
+        return ok;
+    }
+
+    bool setSessionLayer(const string& clothPath, const string& clothingType) {
+        if (layers.empty()) {
+            logError("Сеанс не начат!");
+            return false;
+        }
+        const ClothingRule* rule = findClothingRule(clothingType);
+        if (rule == nullptr) {
+            logError("Неверный тип одежды!");
+            return false;
+        }
+        shared_ptr<const CatalogSnapshot> catalog = catalogSnapshot();
+        const StoredGarment* clothingItem = findGarment(clothPath, catalog.get());
+        if (clothingItem == nullptr) {
+            return false;
+        }
+
+        vector<LayerPiece> pieces;
+        Mat rowArena;
+        auto placeOn = [&](vector<Point>& keypoints) {
+            LayerPiece piece;
+            Size itemSize = rule->calculateSize(keypoints, clothingItem->size());
+            piece.location = rule->calculatePosition(keypoints, itemSize);
+            piece.item.create(itemSize, CV_8UC4);
+            resizeGarment(*clothingItem, piece.item, rowArena);
+            pieces.push_back(piece);
+        };
+        if (multiPerson) {
+            for (vector<Point>& keypoints : sessionPeople) {
+                placeOn(keypoints);
+            }
+        }
+        else {
+            placeOn(sessionKeypoints);
+        }
+
+        long long redrawn;
+        {
+            StageTimer timer(Stage::Blend);
+            redrawn = layers.setLayer(clothingType, move(pieces));
+        }
+        emitEvent("redrawn", to_string(redrawn));
+        scrubBase.release();
+        return deliverFrame("result", resultFileName, layers.composite(), 95);
+    }
+
+    bool removeSessionLayer(const string& clothingType) {
+        long long redrawn = 0;
+        if (layers.empty() || !layers.removeLayer(clothingType, redrawn)) {
+            logError("Нет слоя для снятия: %s", clothingType.c_str());
+            return false;
+        }
+        emitEvent("redrawn", to_string(redrawn));
+        scrubBase.release();
+        return deliverFrame("result", resultFileName, layers.composite(), 95);
+    }
+
+    // Одежда берется из горячо перезагружаемого каталога; запрос держит снимок до конца
+    void setCatalogWatcher(const CatalogWatcher* watcher) {
+        catalogWatcher = watcher;
+    }
+
+    // Префикс имен файлов результата, чтобы несколько движков в одном процессе не писали в один файл
+    void setOutputPrefix(const string& prefix) {
+        previewFileName = prefix + "result_preview.jpg";
+        resultFileName = prefix + "result_with_selected_item.jpg";
+        scrubFileName = prefix + "result_scrub.jpg";
+    }
+
+    // Заранее загружает одежду в кэш (например, пока грузится модель)
+    void preloadGarment(const string& clothPath) {
+        findGarment(clothPath, catalogSnapshot().get());
+    }
+
+    // Одежда в собственном кэше движка хранится сжатой (см. PackedGarment)
+    void setGarmentCompression(bool enabled) {
+        compressGarments = enabled;
+    }
+
+    // Пул движка: на нем идут узлы графа запроса, им же можно распараллелить подготовку
+    WorkStealingPool& executor() {
+        return pool;
+    }
+
+    // Кадры вместо JPEG-файлов отдаются в общую память (текстура Flutter на Linux)
+    void setFrameSink(SharedFrameWriter* sink) {
+        frameSink = sink;
+    }
+
+    // Если flag выставлен во время запроса, еще не начатые стадии пропускаются и запрос
+    // завершается с wasPreempted() (сервер так уступает интерактивным запросам). nullptr - без вытеснения.
+    void setPreemption(const atomic<bool>* flag) {
+        preemptFlag = flag;
+        preempted = false;
+    }
+
+    bool wasPreempted() const {
+        return preempted;
+    }
+
+    // Групповые фото: одежда накладывается на каждого найденного человека
+    void setMultiPerson(bool enabled) {
+        multiPerson = enabled;
+    }
+
+    // Кроп по человеку перед сетью: на общих планах человек занимает малую часть кадра, и при
+    // сжатии всего кадра в 368x368 на конечности приходится несколько клеток тепловой карты.
+    // Человек ищется HOG-детектором; fromPreviousFrame (видео) - сначала берется область по
+    // ключевым точкам предыдущего кадра, детектор запускается, только если их не нашлось.
+    void setPersonCrop(bool enabled, bool fromPreviousFrame = false) {
+        personCrop = enabled;
+        cropFromPreviousFrame = fromPreviousFrame;
+        previousPersonBox = Rect();
+    }
+
+    // Способ смешивания полного кадра (предпросмотр всегда смешивается обычной альфой)
+    void setBlendMode(BlendMode mode) {
+        blendMode = mode;
+    }
+
+    // Ключевые точки последнего запроса для дорожки поз. В режиме нескольких людей
+    // уверенность по PAF не считается, найденные точки получают 1.
+    void lastPose(PoseFrame& pose) const {
+        if (multiPerson) {
+            pose.people = buffers.people;
+            pose.confidences.resize(pose.people.size());
+            for (size_t i = 0; i < pose.people.size(); ++i) {
+                pose.confidences[i].clear();
+                for (const Point& point : pose.people[i]) {
+                    pose.confidences[i].push_back(point.x >= 0 ? 1.0f : 0.0f);
+                }
+            }
+        }
+        else {
+            size_t count = buffers.placements.empty() ? 0 : 1;
+            pose.people.assign(count, buffers.keypoints);
+            pose.confidences.assign(count, buffers.confidences);
+        }
+    }
+
+    // Сколько выделений памяти сделала вычислительная часть последнего запроса
+    // (без чтения одежды и кодирования JPEG)
+    unsigned long long lastRequestAllocations() const {
+        return lastAllocations;
+    }
+
+private:
+    // Вещь, уже отмасштабированная под позу сеанса и разрешение экрана (по картинке на человека)
+    struct ScrubGarment {
+        vector<Mat> items;
+        vector<Point> locations;
+    };
+
+    // Готовые вещи действительны для одного снимка каталога: после перезагрузки кэш сбрасывается
+    const ScrubGarment* scrubGarment(const string& clothPath, const string& clothingType) {
+        shared_ptr<const CatalogSnapshot> catalog = catalogSnapshot();
+        long long epoch = catalog ? catalog->epoch : 0;
+        if (epoch != scrubEpoch) {
+            scrubGarments.clear();
+            scrubEpoch = epoch;
+        }
+        string key = clothingType + "\t" + clothPath;
+        auto prepared = scrubGarments.find(key);
+        if (prepared != scrubGarments.end()) {
+            return &prepared->second;
+        }
+        const ClothingRule* rule = findClothingRule(clothingType);
+        if (rule == nullptr) {
+            logError("Неверный тип одежды!");
+            return nullptr;
+        }
+        // Снимок держится в catalog до конца масштабирования: clothingItem может ссылаться на его вещь
+        const Mat& clothingItem = getGarment(clothPath, catalog.get());
+        if (clothingItem.empty()) {
+            return nullptr;
+        }
+        ScrubGarment garment;
+        auto placeOn = [&](vector<Point>& keypoints) {
+            Size itemSize = rule->calculateSize(keypoints, clothingItem.size());
+            Point location = rule->calculatePosition(keypoints, itemSize);
+            Size scaledSize(max(1, static_cast<int>(itemSize.width * scrubScale)), max(1, static_cast<int>(itemSize.height * scrubScale)));
+            Mat item;
+            resize(clothingItem, item, scaledSize, 0, 0, INTER_AREA);
+            garment.items.push_back(item);
+            garment.locations.push_back(Point(static_cast<int>(location.x * scrubScale), static_cast<int>(location.y * scrubScale)));
+        };
+        if (multiPerson) {
+            for (vector<Point>& keypoints : sessionPeople) {
+                placeOn(keypoints);
+            }
+        }
+        else {
+            placeOn(sessionKeypoints);
+        }
+        return &scrubGarments.emplace(key, move(garment)).first->second;
+    }
+
+    shared_ptr<const CatalogSnapshot> catalogSnapshot() const {
+        return catalogWatcher != nullptr ? catalogWatcher->snapshot() : nullptr;
+    }
+
+    // Данные текущего запроса для узлов графа
+    struct RequestState {
+        const Mat* person = nullptr;
+        const string* clothPath = nullptr;
+        const ClothingRule* rule = nullptr;
+        const StoredGarment* item = nullptr; // одежда из кэша, nullptr если не загрузилась
+        bool interactive = true;   // предпросмотр и выдача результата; false - кадр только в output
+        bool previewOnly = false;  // только предпросмотр, полный кадр не собирается
+        bool preview = true;       // предпросмотр перед полным кадром (только interactive)
+        const PoseFrame* pose = nullptr; // готовые ключевые точки вместо сети
+        bool placed = false;
+        bool ok = false;
+        long long id = 0;          // номер запроса для журнала
+        Mat output;                // полный кадр в арене
+        shared_ptr<const CatalogSnapshot> catalog; // снимок каталога на время запроса
+    };
+
+    // Граф запроса:
+    //   одежда ----------+
+    //   ключевые точки --+-> размещение -> предпросмотр ----------+-> выдача результата
+    //   копия кадра -----------------------> смешивание кадра ----+
+    // Чтение одежды и сеть не зависят друг от друга, поэтому задержка примерно
+    // max(сеть, одежда) + смешивание + кодирование. Если нужен только предпросмотр,
+    // копия и смешивание кадра пропускаются.
+    void buildRequestGraph() {
+        int garment = requestGraph.add([this] {
+            AllocationPause pause;
+            request.item = findGarment(*request.clothPath, request.catalog.get());
+        });
+        int keypoints = requestGraph.add([this] {
+            if (request.pose != nullptr) {
+                applyPose(*request.pose);
+            }
+            else {
+                detectKeypoints(*request.person, request.rule);
+            }
+        });
+        int frame = requestGraph.add([this] {
+            if (request.previewOnly) {
+                return;
+            }
+            request.output = arenaView(buffers.frameArena, request.person->size(), request.person->type());
+            request.person->copyTo(request.output);
+        });
+        int place = requestGraph.add([this] {
+            placeGarment();
+        }, { garment, keypoints });
+        int preview = requestGraph.add([this] {
+            if (request.placed && request.interactive && request.preview) {
+                renderPreview();
+            }
+        }, { place });
+        int blend = requestGraph.add([this] {
+            if (request.placed && !request.previewOnly) {
+                StageTimer timer(Stage::Blend);
+                compositeGarment(request.output, *request.item, buffers.placements, 1.0, buffers.itemArenas, buffers.items,
+                    buffers.itemRowArenas, blendMode, &buffers.pyramids);
+            }
+        }, { place, frame });
+        requestGraph.add([this] {
+            request.ok = request.placed && (!request.interactive || request.previewOnly || deliverResult());
+        }, { preview, blend });
+    }
+
+    bool runRequest(const Mat& person, const string& clothPath, const string& clothingType, bool interactive,
+        const PoseFrame* pose = nullptr, bool previewOnly = false, bool preview = true) {
+        lastAllocations = 0;
+        preempted = false;
+        request.id = ++nextLogRequestId;
+        LogRequestScope logScope(request.id);
+        if (person.empty()) {
+            logError("Пустое изображение человека!");
+            return false;
+        }
+
+        // В зависимости от запроса выбираем правило размещения
+        const ClothingRule* rule = findClothingRule(clothingType);
+        if (rule == nullptr) {
+            logError("Неверный тип одежды!");
+            return false;
+        }
+
+        request.person = &person;
+        request.clothPath = &clothPath;
+        request.rule = rule;
+        request.item = nullptr;
+        request.interactive = interactive;
+        request.previewOnly = previewOnly;
+        request.preview = preview;
+        request.pose = pose;
+        request.placed = false;
+        request.ok = false;
+        request.catalog = catalogSnapshot();
+        {
+            AllocationScope scope(lastAllocations, &pool.allocations());
+            requestGraph.run(pool, request.id, preemptFlag);
+        }
+        preempted = requestGraph.wasCancelled();
+        request.catalog.reset();
+        return request.ok;
+    }
+
+    // Размещение одежды в buffers.placements по найденным ключевым точкам
+    void placeGarment() {
+        if (request.item == nullptr) {
+            return;
+        }
+        if (buffers.placements.empty()) {
+            logError("Не удалось обнаружить ключевые точки!");
+            return;
+        }
+
+        // Размещение считается для каждого найденного человека
+        const ClothingRule& rule = *request.rule;
+        if (multiPerson) {
+            buffers.placements.resize(buffers.people.size());
+            for (size_t i = 0; i < buffers.people.size(); ++i) {
+                Size itemSize = rule.calculateSize(buffers.people[i], request.item->size());
+                buffers.placements[i] = { rule.calculatePosition(buffers.people[i], itemSize), itemSize };
+            }
+        }
+        else {
+            Size itemSize = rule.calculateSize(buffers.keypoints, request.item->size());
+            buffers.placements[0] = { rule.calculatePosition(buffers.keypoints, itemSize), itemSize };
+        }
+        request.placed = true;
+    }
+
+    // Быстрый предпросмотр в разрешении экрана, чтобы Flutter не ждал полного кадра
+    void renderPreview() {
+        TickMeter previewTimer;
+        previewTimer.start();
+        double scale = 1.0;
+        Size previewSize = scaledSizeForMaxSide(request.person->size(), previewMaxSide, scale);
+        Mat preview = arenaView(buffers.previewArena, previewSize, request.person->type());
+        resize(*request.person, preview, previewSize, 0, 0, INTER_AREA);
+        compositeGarment(preview, *request.item, buffers.placements, scale, buffers.previewItemArenas, buffers.previewItems,
+            buffers.previewItemRowArenas);
+        deliverFrame("preview", previewFileName, preview, 80);
+        previewTimer.stop();
+        engineMetrics.observeStage(Stage::Preview, previewTimer.getTimeMilli());
+        if (previewTimer.getTimeMilli() > previewBudgetMs) {
+            logWarn("Предпросмотр занял %g мс (бюджет %g мс)", previewTimer.getTimeMilli(), previewBudgetMs);
+        }
+    }
+
+    // Сохранение результата
+    bool deliverResult() {
+        if (!deliverFrame("result", resultFileName, request.output, 95)) {
+            return false;
+        }
+        double sinceStart = chrono::duration<double, milli>(chrono::steady_clock::now() - processStart).count();
+        if (engineMetrics.markFirstResult(sinceStart)) {
+            emitEvent("ttfr", to_string(static_cast<long long>(sinceStart)));
+        }
+        return true;
+    }
+
+    // Событие "texture <ширина>x<высота>" при выводе в текстуру, иначе "<событие> <путь к JPEG>".
+    // Кадр карусели в текстуре - "scrub_texture", чтобы клиент не принял его за результат примерки.
+    bool deliverFrame(const string& event, const string& jpegPath, const Mat& frame, int jpegQuality) {
+        StageTimer timer(Stage::Encode);
+        AllocationPause pause;
+        if (frameSink != nullptr) {
+            if (!frameSink->publish(frame)) {
+                return false;
+            }
+            emitEvent(event == "scrub" ? "scrub_texture" : "texture", to_string(frame.cols) + "x" + to_string(frame.rows));
+            return true;
+        }
+        if (!writeImageAtomically(jpegPath, frame, jpegQuality)) {
+            return false;
+        }
+        emitEvent(event, jpegPath);
+        return true;
+    }
+
+    // Пиксели одежды для карусели; сжатая вещь распаковывается целиком в буфер движка и действительна
+    // до следующего вызова (запросы и слои сеанса масштабируют сжатую вещь без распаковки, см. resizeGarment)
+    const Mat& getGarment(const string& clothPath, const CatalogSnapshot* catalog) {
+        const StoredGarment* stored = findGarment(clothPath, catalog);
+        if (stored == nullptr) {
+            return emptyGarment;
+        }
+        if (!stored->image.empty()) {
+            return stored->image;
+        }
+        StageTimer timer(Stage::Unpack);
+        buffers.garment = arenaView(buffers.garmentArena, stored->packed->size, CV_8UC4);
+        unpackGarment(*stored->packed, buffers.garment);
+        return buffers.garment;
+    }
+
+    // Сначала снимок каталога (если он подключен), затем собственный кэш движка
+    const StoredGarment* findGarment(const string& clothPath, const CatalogSnapshot* catalog) {
+        if (catalog != nullptr) {
+            auto prepared = catalog->garments.find(catalogKey(clothPath));
+            if (prepared != catalog->garments.end()) {
+                engineMetrics.countGarmentCache(true);
+                return &prepared->second.garment;
+            }
+        }
+        auto cached = garmentCache.find(clothPath);
+        engineMetrics.countGarmentCache(cached != garmentCache.end());
+        if (cached != garmentCache.end()) {
+            return &cached->second;
+        }
+        StageTimer timer(Stage::Decode);
+        Mat garment = imread(clothPath, IMREAD_UNCHANGED);
+        if (garment.empty()) {
+            logError("Не удалось загрузить одежду: %s", clothPath.c_str());
+            return nullptr;
+        }
+        return &garmentCache.emplace(clothPath, storeGarment(garment, compressGarments && garment.channels() == 4)).first->second;
+    }
+
+    // То же, что blobFromImage(person, blob, 1/255, 368x368, 0, swapRB=true), но одним проходом в готовый буфер
+    void prepareInputBlob(const Mat& person) {
+        fusedBlobFromImage(person, buffers.blob, buffers.blobScratch);
+    }
+
+    // Заполняет buffers.placements по одному элементу на человека (размеры считаются позже)
+    // rule нужен только для раннего выхода (по его опорным точкам); nullptr - всегда полная сеть
+    void detectKeypoints(const Mat& person, const ClothingRule* rule) {
+        Rect region = personRegion(person);
+        if (region.width == person.cols && region.height == person.rows) {
+            runPoseNet(person, rule);
+        }
+        else {
+            runPoseNet(person(region), rule);
+            shiftKeypoints(region.tl());
+        }
+        if (cropFromPreviousFrame) {
+            rememberPersonBox(person.size());
+        }
+    }
+
+    // INT8-сеть - только если калибровка разрешила тип одежды (в режиме нескольких людей не используется)
+    bool usesInt8(const ClothingRule* rule) const {
+        return !int8Net.empty() && !multiPerson && rule != nullptr
+            && find(int8Types.begin(), int8Types.end(), rule->type) != int8Types.end();
+    }
+
+    // Сеть и ключевые точки в координатах переданного кадра (кропа)
+    void runPoseNet(const Mat& person, const ClothingRule* rule) {
+        if (!precisionScales.empty() && person.type() == CV_8UC3) {
+            runMultiScale(person);
+            return;
+        }
+        {
+            StageTimer timer(Stage::Inference);
+            prepareInputBlob(person);
+            // У квантованной сети промежуточные слои выдают INT8, ранний выход с ней не сочетается
+            bool int8 = usesInt8(rule);
+            Net& poseNet = int8 ? int8Net : net;
+            poseNet.setInput(buffers.blob);
+            if (!int8 && !multiPerson && !earlyExitLayer.empty() && rule != nullptr) {
+                buffers.netOutput = net.forward(earlyExitLayer);
+                extractKeypoints(buffers.netOutput, person.size(), buffers.keypoints, &buffers.confidences);
+                bool confident = anchorsConfident(*rule, buffers.confidences, earlyExitThreshold);
+                engineMetrics.countEarlyExit(confident);
+                // Если ранний выход и есть последние тепловые карты, полная сеть ничего не уточнит
+                if (confident || earlyExitLayer == heatmapLayer) {
+                    buffers.placements.resize(1);
+                    return;
+                }
+            }
+            bool heatmapsOnly = !int8 && !multiPerson && !heatmapLayer.empty();
+            buffers.netOutput = heatmapsOnly ? poseNet.forward(heatmapLayer) : poseNet.forward();
+        }
+        StageTimer timer(Stage::Keypoints);
+        if (multiPerson) {
+            extractPeopleKeypoints(buffers.netOutput, person.size(), buffers.people);
+            buffers.placements.resize(buffers.people.size());
+        }
+        else {
+            extractKeypoints(buffers.netOutput, person.size(), buffers.keypoints, &buffers.confidences);
+            buffers.placements.resize(buffers.keypoints.empty() ? 0 : 1);
+        }
+    }
+
+    // Точный режим: все масштабы одним пакетом, затем усредненные тепловые карты
+    void runMultiScale(const Mat& person) {
+        const int NUM_KEYPOINTS = 25;
+        const int count = static_cast<int>(precisionScales.size());
+        const int side = buffers.batchBlob.size[3];
+        {
+            StageTimer timer(Stage::Inference);
+            for (int k = 0; k < count; ++k) {
+                int scaledSide = max(1, cvRound(side * precisionScales[k]));
+                fusedBlobFromImage(person, buffers.batchBlob, buffers.batchScratch[k], k, Size(scaledSide, scaledSide));
+                // Дополнение серым, как у OpenPose (вход сети в [0, 1])
+                for (int c = 0; c < 3 && scaledSide < side; ++c) {
+                    Mat plane(side, side, CV_32F, buffers.batchBlob.ptr(k, c));
+                    plane(Rect(scaledSide, 0, side - scaledSide, scaledSide)).setTo(Scalar(0.5));
+                    plane(Rect(0, scaledSide, side, side - scaledSide)).setTo(Scalar(0.5));
+                }
+            }
+            net.setInput(buffers.batchBlob);
+            buffers.netOutput = multiPerson || heatmapLayer.empty() ? net.forward() : net.forward(heatmapLayer);
+        }
+        StageTimer timer(Stage::Keypoints);
+        fuseScaleHeatmaps(multiPerson ? buffers.netOutput.size[1] : NUM_KEYPOINTS); // PAF нужны только группировке людей
+        if (multiPerson) {
+            extractPeopleKeypoints(buffers.fusedOutput, person.size(), buffers.people);
+            buffers.placements.resize(buffers.people.size());
+        }
+        else {
+            extractKeypoints(buffers.fusedOutput, person.size(), buffers.keypoints, &buffers.confidences);
+            buffers.placements.resize(buffers.keypoints.empty() ? 0 : 1);
+        }
+    }
+
+    // Карта каждого масштаба (без серого дополнения) растягивается до размера карты масштаба 1,
+    // карты складываются и делятся на число масштабов; результат 1xCxHxW в buffers.fusedOutput
+    void fuseScaleHeatmaps(int channels) {
+        const Mat& output = buffers.netOutput;
+        const int count = output.size[0];
+        const int height = output.size[2], width = output.size[3];
+        const int fusedSizes[] = { 1, channels, height, width };
+        buffers.fusedOutput.create(4, fusedSizes, CV_32F);
+        for (int c = 0; c < channels; ++c) {
+            Mat fused(height, width, CV_32F, buffers.fusedOutput.ptr(0, c));
+            Mat(height, width, CV_32F, const_cast<uchar*>(output.ptr(0, c))).copyTo(fused);
+            for (int k = 1; k < count; ++k) {
+                Mat heatmap(height, width, CV_32F, const_cast<uchar*>(output.ptr(k, c)));
+                Rect valid(0, 0, max(1, cvRound(width * precisionScales[k])), max(1, cvRound(height * precisionScales[k])));
+                resize(heatmap(valid), buffers.scaledHeatmap, fused.size(), 0, 0, INTER_CUBIC);
+                fused += buffers.scaledHeatmap;
+            }
+            fused *= 1.0 / count;
+        }
+    }
+
+    // Область сети на кадре: рамка человека с полями, дополненная почти до квадрата, чтобы вход
+    // 368x368 не сплющивал человека. Весь кадр, если кроп выключен, человек не найден или
+    // рамка и так занимает почти весь кадр.
+    Rect personRegion(const Mat& person) {
+        Rect full(0, 0, person.cols, person.rows);
+        if (!personCrop) {
+            return full;
+        }
+        Rect box = cropFromPreviousFrame ? previousPersonBox : Rect();
+        if (box.empty()) {
+            box = detectPersonBox(person);
+        }
+        if (box.empty()) {
+            return full;
+        }
+        int padX = static_cast<int>(box.width * personCropPadding);
+        int padY = static_cast<int>(box.height * personCropPadding);
+        Rect region(box.x - padX, box.y - padY, box.width + 2 * padX, box.height + 2 * padY);
+        if (region.width < region.height) {
+            int grow = region.height - region.width;
+            region.x -= grow / 2;
+            region.width += grow;
+        }
+        else {
+            int grow = region.width - region.height;
+            region.y -= grow / 2;
+            region.height += grow;
+        }
+        region &= full;
+        if (region.width < personCropMinSide || region.height < personCropMinSide ||
+            region.area() > personCropMaxShare * full.area()) {
+            return full;
+        }
+        return region;
+    }
+
+    // Самая большая рамка HOG-детектора (в режиме нескольких людей - объединение всех рамок).
+    // Детектор работает на уменьшенном кадре; он находит стоящих людей, для примерки этого достаточно.
+    Rect detectPersonBox(const Mat& person) {
+        StageTimer timer(Stage::Localize);
+        double scale = 1.0;
+        Size detectSize = scaledSizeForMaxSide(person.size(), personDetectMaxSide, scale);
+        resize(person, buffers.detectInput, detectSize, 0, 0, INTER_AREA);
+        peopleDetector.detectMultiScale(buffers.detectInput, buffers.personBoxes, 0, Size(8, 8));
+        Rect box;
+        for (const Rect& found : buffers.personBoxes) {
+            if (multiPerson) {
+                box = box.empty() ? found : (box | found);
+            }
+            else if (found.area() > box.area()) {
+                box = found;
+            }
+        }
+        if (box.empty()) {
+            return box;
+        }
+        return Rect(static_cast<int>(box.x / scale), static_cast<int>(box.y / scale),
+            static_cast<int>(box.width / scale), static_cast<int>(box.height / scale));
+    }
+
+    // Переводит найденные точки из координат кропа в координаты кадра
+    void shiftKeypoints(Point offset) {
+        auto shift = [offset](vector<Point>& keypoints) {
+            for (Point& point : keypoints) {
+                if (point.x >= 0 && point.y >= 0) {
+                    point += offset;
+                }
+            }
+        };
+        if (multiPerson) {
+            for (vector<Point>& keypoints : buffers.people) {
+                shift(keypoints);
+            }
+        }
+        else {
+            shift(buffers.keypoints);
+        }
+    }
+
+    // Рамка найденных точек для следующего кадра видео; если точек мало, следующий кадр
+    // снова ищет человека детектором
+    void rememberPersonBox(Size frameSize) {
+        int minX = frameSize.width, minY = frameSize.height, maxX = -1, maxY = -1, found = 0;
+        auto extend = [&](const vector<Point>& keypoints) {
+            for (const Point& point : keypoints) {
+                if (point.x >= 0 && point.y >= 0) {
+                    minX = min(minX, point.x);
+                    minY = min(minY, point.y);
+                    maxX = max(maxX, point.x);
+                    maxY = max(maxY, point.y);
+                    ++found;
+                }
+            }
+        };
+        if (multiPerson) {
+            for (const vector<Point>& keypoints : buffers.people) {
+                extend(keypoints);
+            }
+        }
+        else {
+            extend(buffers.keypoints);
+        }
+        previousPersonBox = found >= personTrackMinKeypoints ? Rect(minX, minY, maxX - minX + 1, maxY - minY + 1) : Rect();
+    }
+
+    // То же заполнение buffers.placements, но по ключевым точкам из дорожки поз
+    void applyPose(const PoseFrame& pose) {
+        if (multiPerson) {
+            buffers.people = pose.people;
+            buffers.placements.resize(buffers.people.size());
+        }
+        else if (pose.people.empty()) {
+            buffers.keypoints.clear();
+            buffers.placements.clear();
+        }
+        else {
+            buffers.keypoints = pose.people[0];
+            buffers.confidences = pose.confidences[0];
+            buffers.placements.resize(1);
+        }
+    }
+
+    WorkStealingPool pool;
+    TaskGraph requestGraph;
+    RequestState request;
+    Net net;
+    Net int8Net;              // пусто, если INT8 не включен
+    vector<string> int8Types; // типы одежды, для которых считается int8Net
+    vector<string> heatmapExits;
+    string heatmapLayer; // одиночный режим: forward до последних тепловых карт, без склейки с PAF
+    string earlyExitLayer;
+    float earlyExitThreshold = 0.0f;
+    WorkerBuffers buffers;
+    map<string, StoredGarment> garmentCache;
+    Mat emptyGarment;
+    LayerStack layers;
+    vector<Point> sessionKeypoints;
+    vector<vector<Point>> sessionPeople;
+    map<string, ScrubGarment> scrubGarments; // готовые вещи карусели для текущего сеанса
+    long long scrubEpoch = 0;                 // снимок каталога, по которому готовы scrubGarments
+    Mat scrubBase;                            // образ сеанса в разрешении экрана
+    double scrubScale = 1.0;
+    SharedFrameWriter* frameSink = nullptr;
+    const CatalogWatcher* catalogWatcher = nullptr;
+    string previewFileName = "result_preview.jpg";
+    string resultFileName = "result_with_selected_item.jpg";
+    string scrubFileName = "result_scrub.jpg";
+    bool multiPerson = false;
+    BlendMode blendMode = BlendMode::Alpha;
+    bool compressGarments = false;
+    vector<double> precisionScales; // пусто - обычный режим, иначе масштабы точного режима
+    unsigned long long lastAllocations = 0;
+    const atomic<bool>* preemptFlag = nullptr;
+    bool preempted = false;
+    HOGDescriptor peopleDetector;
+    bool personCrop = false;
+    bool cropFromPreviousFrame = false;
+    Rect previousPersonBox;
+
+    static constexpr double personCropPadding = 0.2;  // поля вокруг рамки, доля ее размера
+    static constexpr double personCropMaxShare = 0.7; // больше этой доли кадра кроп не дает выигрыша
+    static constexpr int personCropMinSide = 32;
+    static constexpr int personDetectMaxSide = 640;   // длинная сторона кадра для детектора
+    static constexpr int personTrackMinKeypoints = 4; // столько точек нужно, чтобы вести человека по видео
+};
+
+// --- Функция обработки запроса из Flutter ---
+void processClothingRequest(const string& clothingType, const Mat& person, const string& modelPath, const string& protoPath,
+    SharedFrameWriter* frameSink, bool multiPerson, BlendMode blendMode, bool personCrop) {
+    // Чтение wearPath.txt и одежды идет одновременно с загрузкой модели
+    TryOnEngine engine;
+    string clothPath;
+    bool modelLoaded = false;
+    TaskGraph startup;
+    int readClothPath = startup.add([&clothPath] {
+        //получение фото одежды
+        string clothInput = "H:\\OutfitME\\outfit_me\\clTest\\x64\\Debug\\wearPath.txt";
+        ifstream inputFile(clothInput);
+        string buffer;
+        if (!inputFile.is_open()) {
+            logError("Не удалось открыть wearPath.txt!");
+            return;
+        }
+        getline(inputFile, buffer);
+        clothPath = "H:/OutfitME/outfit_me/" + buffer; // Это значение должно быть передано из Flutter !!!!!!!!!!!!!!!!!!!!!!
+    });
+    startup.add([&engine, &clothPath] {
+        if (!clothPath.empty()) {
+            engine.preloadGarment(clothPath);
+        }
+    }, { readClothPath });
+    // Загружаем модель для ключевых точек
+    startup.add([&engine, &modelLoaded, &modelPath, &protoPath] {
+        modelLoaded = engine.load(modelPath, protoPath);
+    });
+    startup.run(engine.executor());
+    if (clothPath.empty() || !modelLoaded) {
+        return;
+    }
+    engine.setFrameSink(frameSink);
+    engine.setMultiPerson(multiPerson);
+    engine.setBlendMode(blendMode);
+    engine.setPersonCrop(personCrop);
+    engine.processRequest(person, clothPath, clothingType);
+}
+
+// --- Подготовка новой одежды для каталога (--ingest) ---
+// Из обычных фото товара на однотонном фоне делает PNG с прозрачностью, как в assets/images.
+// Тип одежды берется из имени подпапки: <src>/tshirt/*.jpg. Прогресс пишется в
+// <dst>/ingest_progress.txt, поэтому повторный запуск продолжает с места остановки.
+
+struct GarmentAnchor {
+    string name;
+    Point position;
+};
+
+// Цвет фона - медиана по рамке шириной в 2 пикселя
+Vec3b estimateBorderColor(const Mat& image) {
+    vector<uchar> channels[3];
+    for (int y = 0; y < image.rows; ++y) {
+        for (int x = 0; x < image.cols; ++x) {
+            if (y >= 2 && y < image.rows - 2 && x >= 2 && x < image.cols - 2) {
+                x = image.cols - 3;
+                continue;
+            }
+            const Vec3b& pixel = image.at<Vec3b>(y, x);
+            for (int c = 0; c < 3; ++c) {
+                channels[c].push_back(pixel[c]);
+            }
+        }
+    }
+    Vec3b color;
+    for (int c = 0; c < 3; ++c) {
+        nth_element(channels[c].begin(), channels[c].begin() + channels[c].size() / 2, channels[c].end());
+        color[c] = channels[c][channels[c].size() / 2];
+    }
+    return color;
+}
+
+// Расстояние каждого пикселя до цвета фона (сумма модулей по каналам, до 255)
+Mat distanceToColor(const Mat& image, Vec3b color) {
+    Mat distance(image.size(), CV_8UC1);
+    for (int y = 0; y < image.rows; ++y) {
+        const Vec3b* row = image.ptr<Vec3b>(y);
+        uchar* out = distance.ptr<uchar>(y);
+        for (int x = 0; x < image.cols; ++x) {
+            int d = abs(row[x][0] - color[0]) + abs(row[x][1] - color[1]) + abs(row[x][2] - color[2]);
+            out[x] = saturate_cast<uchar>(d);
+        }
+    }
+    return distance;
+}
+
+// Маска прозрачности: порог по расстоянию до фона задает начальную разметку,
+// grabCut на уменьшенной копии уточняет ее, затем порог на полном размере убирает ореол фона
+Mat extractGarmentAlpha(const Mat& photo) {
+    const int backgroundThreshold = 40;
+    const int workMaxSide = 400;
+
+    Vec3b background = estimateBorderColor(photo);
+    double scale = 1.0;
+    Size workSize = scaledSizeForMaxSide(photo.size(), workMaxSide, scale);
+    Mat small;
+    resize(photo, small, workSize, 0, 0, INTER_AREA);
+
+    Mat distance = distanceToColor(small, background);
+    Mat mask(small.size(), CV_8UC1, Scalar(GC_PR_BGD));
+    mask.setTo(Scalar(GC_PR_FGD), distance > backgroundThreshold);
+    if (countNonZero(distance > backgroundThreshold) == 0) {
+        return Mat();
+    }
+    const int border = 3;
+    mask.rowRange(0, border).setTo(Scalar(GC_BGD));
+    mask.rowRange(mask.rows - border, mask.rows).setTo(Scalar(GC_BGD));
+    mask.colRange(0, border).setTo(Scalar(GC_BGD));
+    mask.colRange(mask.cols - border, mask.cols).setTo(Scalar(GC_BGD));
+
+    Mat backgroundModel, foregroundModel;
+    grabCut(small, mask, Rect(), backgroundModel, foregroundModel, 3, GC_INIT_WITH_MASK);
+
+    Mat foreground = (mask == GC_FGD) | (mask == GC_PR_FGD);
+    Mat kernel = getStructuringElement(MORPH_ELLIPSE, Size(3, 3));
+    morphologyEx(foreground, foreground, MORPH_OPEN, kernel);
+    morphologyEx(foreground, foreground, MORPH_CLOSE, kernel);
+
+    Mat alpha;
+    resize(foreground, alpha, photo.size(), 0, 0, INTER_LINEAR);
+    alpha.setTo(Scalar(0), distanceToColor(photo, background) < backgroundThreshold / 2);
+    GaussianBlur(alpha, alpha, Size(3, 3), 0);
+    return alpha;
+}
+
+// Крайние точки маски в строке y (левая и правая), false если строка пустая
+bool maskRowExtent(const Mat& alpha, int y, int& left, int& right) {
+    const uchar* row = alpha.ptr<uchar>(y);
+    left = -1;
+    right = -1;
+    for (int x = 0; x < alpha.cols; ++x) {
+        if (row[x] > 128) {
+            if (left < 0) {
+                left = x;
+            }
+            right = x;
+        }
+    }
+    return left >= 0;
+}
+
+// Центр масс маски в прямоугольнике
+Point maskCentroid(const Mat& alpha, Rect area) {
+    double sumX = 0, sumY = 0, count = 0;
+    for (int y = area.y; y < area.y + area.height; ++y) {
+        const uchar* row = alpha.ptr<uchar>(y);
+        for (int x = area.x; x < area.x + area.width; ++x) {
+            if (row[x] > 128) {
+                sumX += x;
+                sumY += y;
+                ++count;
+            }
+        }
+    }
+    if (count == 0) {
+        return Point(area.x + area.width / 2, area.y + area.height / 2);
+    }
+    return Point(static_cast<int>(sumX / count), static_cast<int>(sumY / count));
+}
+
+// Опорные точки вещи по ее маске (для майки - горловина и плечи, для штанов - пояс и штанины и т.д.)
+vector<GarmentAnchor> estimateGarmentAnchors(const Mat& alpha, const string& clothingType) {
+    vector<GarmentAnchor> anchors;
+    int top = 0, bottom = alpha.rows - 1, left = 0, right = 0;
+    while (top < alpha.rows && !maskRowExtent(alpha, top, left, right)) {
+        ++top;
+    }
+    while (bottom > top && !maskRowExtent(alpha, bottom, left, right)) {
+        --bottom;
+    }
+    if (top >= alpha.rows) {
+        return anchors;
+    }
+
+    int topLeft, topRight, bottomLeft, bottomRight;
+    maskRowExtent(alpha, top, topLeft, topRight);
+    maskRowExtent(alpha, bottom, bottomLeft, bottomRight);
+
+    if (clothingType == "tshirt" || clothingType == "hat") {
+        // Плечи (поля шляпы) - самые широкие точки в верхней трети (для шляпы - по всей высоте)
+        int lastRow = clothingType == "tshirt" ? top + (bottom - top) / 3 : bottom;
+        Point widestLeft(alpha.cols, 0), widestRight(-1, 0);
+        for (int y = top; y <= lastRow; ++y) {
+            int l, r;
+            if (!maskRowExtent(alpha, y, l, r)) {
+                continue;
+            }
+            if (l < widestLeft.x) {
+                widestLeft = Point(l, y);
+            }
+            if (r > widestRight.x) {
+                widestRight = Point(r, y);
+            }
+        }
+        if (clothingType == "tshirt") {
+            anchors.push_back({ "neck", Point((topLeft + topRight) / 2, top) });
+            anchors.push_back({ "left_shoulder", widestLeft });
+            anchors.push_back({ "right_shoulder", widestRight });
+            anchors.push_back({ "hem", Point((bottomLeft + bottomRight) / 2, bottom) });
+        }
+        else {
+            anchors.push_back({ "crown", Point((topLeft + topRight) / 2, top) });
+            anchors.push_back({ "brim_left", widestLeft });
+            anchors.push_back({ "brim_right", widestRight });
+            anchors.push_back({ "brim_center", Point((bottomLeft + bottomRight) / 2, bottom) });
+        }
+    }
+    else if (clothingType == "pants") {
+        int middle = (bottomLeft + bottomRight) / 2;
+        anchors.push_back({ "waist", Point((topLeft + topRight) / 2, top) });
+        anchors.push_back({ "left_leg", maskCentroid(alpha, Rect(0, bottom - (bottom - top) / 10, middle, (bottom - top) / 10 + 1)) });
+        anchors.push_back({ "right_leg", maskCentroid(alpha, Rect(middle, bottom - (bottom - top) / 10, alpha.cols - middle, (bottom - top) / 10 + 1)) });
+    }
+    else if (clothingType == "glasses") {
+        anchors.push_back({ "left_lens", maskCentroid(alpha, Rect(0, 0, alpha.cols / 2, alpha.rows)) });
+        anchors.push_back({ "right_lens", maskCentroid(alpha, Rect(alpha.cols / 2, 0, alpha.cols - alpha.cols / 2, alpha.rows)) });
+        anchors.push_back({ "bridge", Point(alpha.cols / 2, maskCentroid(alpha, Rect(0, 0, alpha.cols, alpha.rows)).y) });
+    }
+    else {
+        anchors.push_back({ "center", maskCentroid(alpha, Rect(0, 0, alpha.cols, alpha.rows)) });
+    }
+    return anchors;
+}
+
+// Одна вещь: прозрачность, обрезка по маске, опорные точки, запись PNG и файла опорных точек
+bool ingestGarment(const fs::path& sourcePath, const string& clothingType, const fs::path& targetPath) {
+    Mat source = imread(sourcePath.string(), IMREAD_UNCHANGED);
+    if (source.empty()) {
+        logError("Не удалось загрузить фото одежды: %s", sourcePath.string().c_str());
+        return false;
+    }
+
+    Mat color, alpha;
+    if (source.channels() == 4) {
+        // Уже с прозрачностью: берем готовую маску, если она не пустая
+        cvtColor(source, color, COLOR_BGRA2BGR);
+        extractChannel(source, alpha, 3);
+        if (countNonZero(alpha < 255) == 0) {
+            alpha = extractGarmentAlpha(color);
+        }
+    }
+    else {
+        if (source.channels() == 1) {
+            cvtColor(source, color, COLOR_GRAY2BGR);
+        }
+        else {
+            color = source;
+        }
+        alpha = extractGarmentAlpha(color);
+    }
+    if (alpha.empty() || countNonZero(alpha > 8) == 0) {
+        logError("Не удалось выделить одежду на фото: %s", sourcePath.string().c_str());
+        return false;
+    }
+
+    // Обрезка по ограничивающему прямоугольнику с небольшим запасом
+    vector<Point> opaque;
+    findNonZero(alpha > 8, opaque);
+    const int pad = 2;
+    Rect box = boundingRect(opaque);
+    box = Rect(box.x - pad, box.y - pad, box.width + 2 * pad, box.height + 2 * pad) & Rect(0, 0, alpha.cols, alpha.rows);
+
+    // 3 канала цвета + маска = BGRA
+    Mat garment;
+    Mat channels[] = { color(box), alpha(box) };
+    merge(channels, 2, garment);
+
+    fs::create_directories(targetPath.parent_path());
+    if (!imwrite(targetPath.string(), garment)) {
+        logError("Не удалось сохранить одежду: %s", targetPath.string().c_str());
+        return false;
+    }
+
+    vector<GarmentAnchor> anchors = estimateGarmentAnchors(alpha(box), clothingType);
+    fs::path anchorsPath = targetPath;
+    anchorsPath.replace_extension(".anchors.txt");
+    ofstream anchorsFile(anchorsPath);
+    for (const GarmentAnchor& anchor : anchors) {
+        anchorsFile << anchor.name << " " << anchor.position.x << " " << anchor.position.y << "\n";
+    }
+    return true;
+}
+
+bool isImageFile(const fs::path& path) {
+    string extension = path.extension().string();
+    transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    return extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".webp" || extension == ".bmp";
+}
+
+// Обходит <src>/<тип>/..., обрабатывает фото параллельно и дописывает готовые вещи в <dst>/catalog.txt
+int runIngestMode(const string& sourceDir, const string& targetDir) {
+    struct IngestItem {
+        fs::path source;
+        string type;
+    };
+
+    fs::create_directories(targetDir);
+    fs::path progressPath = fs::path(targetDir) / "ingest_progress.txt";
+    fs::path catalogPath = fs::path(targetDir) / "catalog.txt";
+
+    // Уже обработанные фото (с прошлого запуска) пропускаем
+    set<string> done;
+    {
+        ifstream progressFile(progressPath);
+        string line;
+        while (getline(progressFile, line)) {
+            done.insert(line);
+        }
+    }
+    set<string> catalogLines;
+    {
+        ifstream catalogFile(catalogPath);
+        string line;
+        while (getline(catalogFile, line)) {
+            catalogLines.insert(line);
+        }
+    }
+
+    vector<IngestItem> items;
+    error_code error;
+    for (fs::recursive_directory_iterator it(sourceDir, error), end; !error && it != end; it.increment(error)) {
+        if (!it->is_regular_file() || !isImageFile(it->path())) {
+            continue;
+        }
+        string type = it->path().parent_path().filename().string();
+        if (findClothingRule(type) == nullptr) {
+            logError("Неизвестный тип одежды (имя папки): %s", it->path().string().c_str());
+            continue;
+        }
+        if (done.count(it->path().generic_string()) == 0) {
+            items.push_back({ it->path(), type });
+        }
+    }
+    if (error) {
+        logError("Не удалось прочитать папку: %s", sourceDir.c_str());
+        return -1;
+    }
+
+    mutex outputMutex;
+    ofstream progressFile(progressPath, ios::app);
+    ofstream catalogFile(catalogPath, ios::app);
+    atomic<int> processed{ 0 }, failed{ 0 };
+    int total = static_cast<int>(items.size());
+
+    WorkStealingPool pool;
+    pool.parallelFor(total, [&](int i) {
+        const IngestItem& item = items[i];
+        fs::path target = fs::path(targetDir) / item.type / item.source.filename();
+        target.replace_extension(".png");
+
+        bool ok = ingestGarment(item.source, item.type, target);
+        lock_guard<mutex> lock(outputMutex);
+        if (ok) {
+            string catalogLine = target.generic_string() + " " + item.type;
+            if (catalogLines.insert(catalogLine).second) {
+                catalogFile << catalogLine << "\n";
+                catalogFile.flush();
+            }
+        }
+        else {
+            ++failed;
+        }
+        // Неудачные тоже отмечаем, чтобы не повторять их при каждом запуске
+        progressFile << item.source.generic_string() << "\n";
+        progressFile.flush();
+        int count = ++processed;
+        if (count % 100 == 0 || count == total) {
+            emitEvent("progress", to_string(count) + "/" + to_string(total));
+        }
+    });
+
+    cout << "Обработано: " << processed.load() << ", с ошибками: " << failed.load()
+        << ", пропущено ранее обработанных: " << done.size() << endl;
+    return failed.load() == 0 ? 0 : 1;
+}
+
+// --- Функция разбиения строки запроса на поля ---
+vector<string> splitFields(const string& line, char separator) {
+    vector<string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t end = line.find(separator, start);
+        fields.push_back(line.substr(start, end - start));
+        if (end == string::npos) {
+            return fields;
+        }
+        start = end + 1;
+    }
+}
+
+// --- Режим сервера ---
+// Модель загружается один раз, запросы читаются из stdin по одному в строке:
+// tryon<TAB>путь к фото<TAB>путь к одежде<TAB>тип одежды
+// Сеанс образа (одно фото, вещи слоями, пересобирается только измененная область):
+// session<TAB>путь к фото, layer<TAB>путь к одежде<TAB>тип одежды, remove<TAB>тип одежды.
+// После каждого запроса tryon в stdout пишется "allocs <n>" - выделения памяти за запрос.
+// У запросов scrub свои события ("scrub", "scrub_texture", "scrub_error"), чтобы кадры и ошибки
+// карусели не смешивались с примеркой, идущей в том же потоке.
+
+// Выполняет одну строку запроса; false - запрос не выполнен (событие error уже выдано)
+bool handleRequestLine(TryOnEngine& engine, const string& line, RenderTier tier = RenderTier::Full, bool preview = true) {
+    vector<string> fields = splitFields(line, '\t');
+    if (fields[0] == "layer" && fields.size() == 3) {
+        if (!engine.setSessionLayer(fields[1], fields[2])) {
+            emitEvent("error", "failed");
+            return false;
+        }
+        return true;
+    }
+    if (fields[0] == "scrub" && fields.size() == 3) {
+        if (!engine.scrubTo(fields[1], fields[2])) {
+            emitEvent("scrub_error", "failed");
+            return false;
+        }
+        return true;
+    }
+    if (fields[0] == "remove" && fields.size() == 2) {
+        if (!engine.removeSessionLayer(fields[1])) {
+            emitEvent("error", "failed");
+            return false;
+        }
+        return true;
+    }
+    bool session = fields[0] == "session" && fields.size() == 2;
+    if (!session && (fields[0] != "tryon" || fields.size() != 4)) {
+        logError("Неверный запрос: %s", line.c_str());
+        emitEvent("error", "bad_request");
+        return false;
+    }
+
+    Mat person;
+    {
+        StageTimer timer(Stage::Decode);
+        person = imread(fields[1]);
+    }
+    if (person.empty()) {
+        logError("Не удалось загрузить изображение: %s", fields[1].c_str());
+        emitEvent("error", "bad_photo");
+        return false;
+    }
+    if (session) {
+        if (!engine.beginSession(person)) {
+            emitEvent("error", "failed");
+            return false;
+        }
+        return true;
+    }
+    if (!engine.processRequest(person, fields[2], fields[3], tier, preview)) {
+        if (!engine.wasPreempted()) {
+            emitEvent("error", "failed");
+        }
+        return false;
+    }
+    emitEvent("allocs", to_string(engine.lastRequestAllocations()));
+    return true;
+}
+
+bool isScrubRequest(const string& line) {
+    return line.compare(0, 6, "scrub\t") == 0;
+}
+
+// --- Планировщик запросов сервера ---
+// Строка может начинаться с класса и срока: "interactive|batch<TAB><срок, мс><TAB><запрос>".
+// Срок считается от поступления строки, 0 - без срока. Строки без префикса (так шлет
+// приложение) - интерактивные без срока.
+struct ScheduledRequest {
+    string line; // запрос без префикса
+    RequestClass requestClass = RequestClass::Interactive;
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max();
+    long long sequence = 0; // порядок поступления
+
+    bool hasDeadline() const {
+        return deadline != chrono::steady_clock::time_point::max();
+    }
+};
+
+ScheduledRequest parseScheduledRequest(const string& line, chrono::steady_clock::time_point arrival) {
+    ScheduledRequest request;
+    bool batch = line.compare(0, 6, "batch\t") == 0;
+    size_t classEnd = line.find('\t');
+    size_t deadlineEnd = classEnd == string::npos ? string::npos : line.find('\t', classEnd + 1);
+    if ((!batch && line.compare(0, 12, "interactive\t") != 0) || deadlineEnd == string::npos) {
+        request.line = line;
+        return request;
+    }
+    request.requestClass = batch ? RequestClass::Batch : RequestClass::Interactive;
+    long long deadlineMs = atoll(line.substr(classEnd + 1, deadlineEnd - classEnd - 1).c_str());
+    if (deadlineMs > 0) {
+        request.deadline = arrival + chrono::milliseconds(deadlineMs);
+    }
+    request.line = line.substr(deadlineEnd + 1);
+    return request;
+}
+
+// Очередь по классам: интерактивные запросы всегда раньше пакетных, внутри класса - ближайший
+// срок первым (EDF), запросы без срока - за ними в порядке поступления. interactiveWaiting()
+// выставлен, пока есть ждущие интерактивные запросы, - по нему пакетный запрос вытесняется.
+class RequestScheduler {
+public:
+    void push(ScheduledRequest request) {
+        lock_guard<mutex> lock(queueMutex);
+        request.sequence = nextSequence++;
+        enqueue(move(request));
+    }
+
+    // Вытесненный запрос возвращается с прежними сроком и номером, то есть на свое место
+    void requeue(ScheduledRequest request) {
+        lock_guard<mutex> lock(queueMutex);
+        enqueue(move(request));
+    }
+
+    // Новых запросов не будет; pop отдает оставшиеся и затем возвращает false
+    void close() {
+        lock_guard<mutex> lock(queueMutex);
+        closed = true;
+        ready.notify_one();
+    }
+
+    // Из подряд идущих (по порядку выполнения) запросов "scrub" отдается только последний
+    bool pop(ScheduledRequest& request) {
+        unique_lock<mutex> lock(queueMutex);
+        ready.wait(lock, [this] { return closed || !queues[0].empty() || !queues[1].empty(); });
+        for (deque<ScheduledRequest>& queue : queues) {
+            if (queue.empty()) {
+                continue;
+            }
+            request = takeEarliest(queue);
+            while (isScrubRequest(request.line) && !queue.empty() && isScrubRequest(earliest(queue)->line)) {
+                request = takeEarliest(queue);
+                engineMetrics.countScrubDropped();
+            }
+            interactivePending = !queues[static_cast<int>(RequestClass::Interactive)].empty();
+            return true;
+        }
+        return false;
+    }
+
+    const atomic<bool>& interactiveWaiting() const {
+        return interactivePending;
+    }
+
+private:
+    void enqueue(ScheduledRequest request) {
+        bool interactive = request.requestClass == RequestClass::Interactive;
+        queues[static_cast<int>(request.requestClass)].push_back(move(request));
+        if (interactive) {
+            interactivePending = true;
+        }
+        ready.notify_one();
+    }
+
+    // Очереди короткие (один клиент на stdin), поэтому достаточно линейного поиска
+    static deque<ScheduledRequest>::iterator earliest(deque<ScheduledRequest>& queue) {
+        return min_element(queue.begin(), queue.end(), [](const ScheduledRequest& a, const ScheduledRequest& b) {
+            return a.deadline != b.deadline ? a.deadline < b.deadline : a.sequence < b.sequence;
+        });
+    }
+
+    static ScheduledRequest takeEarliest(deque<ScheduledRequest>& queue) {
+        deque<ScheduledRequest>::iterator it = earliest(queue);
+        ScheduledRequest request = move(*it);
+        queue.erase(it);
+        return request;
+    }
+
+    mutex queueMutex;
+    condition_variable ready;
+    deque<ScheduledRequest> queues[static_cast<int>(RequestClass::Count)];
+    atomic<bool> interactivePending{ false };
+    long long nextSequence = 0;
+    bool closed = false;
+};
+
+// Уровень исполнения примерки под срок: оценки времени уровней - скользящее среднее
+// выполненных запросов (уровень без замеров считается успевающим), выбирается первый
+// уровень, который успевает. Не успевает ни один - запрос отбрасывается.
+class DeadlinePlanner {
+public:
+    bool choose(const ScheduledRequest& request, RenderTier& tier) const {
+        tier = RenderTier::Full;
+        if (!request.hasDeadline()) {
+            return true;
+        }
+        double remainingMs = chrono::duration<double, milli>(request.deadline - chrono::steady_clock::now()).count();
+        for (int t = 0; t < static_cast<int>(RenderTier::Count); ++t) {
+            if (estimateMs[t] <= remainingMs) {
+                tier = static_cast<RenderTier>(t);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void observe(RenderTier tier, double milliseconds) {
+        double& estimate = estimateMs[static_cast<int>(tier)];
+        estimate = estimate == 0 ? milliseconds : estimate + smoothing * (milliseconds - estimate);
+    }
+
+private:
+    static constexpr double smoothing = 0.2;
+    double estimateMs[static_cast<int>(RenderTier::Count)] = {};
+};
+
+// Метрики (если задан metricsPath) переписываются после каждого запроса. Если задан
+// capturePath, каждая строка запроса записывается туда как "<мс от старта><TAB><строка>"
+// для последующего воспроизведения (--replay).
+// stdin читается отдельным потоком, чтобы видеть очередь: при быстрой прокрутке карусели
+// из подряд идущих запросов "scrub" выполняется только последний, остальные пропускаются.
+// Очередь упорядочена RequestScheduler. Пакетная примерка прерывается на границе стадий,
+// как только пришел интерактивный запрос, и затем выполняется заново. Примерке со сроком
+// DeadlinePlanner выбирает уровень; перед уменьшенным уровнем выдается "tier <уровень>",
+// а если срок не выполнить, то "error deadline".
+void runServeMode(TryOnEngine& engine, const string& metricsPath, const string& capturePath) {
+    ofstream capture;
+    if (!capturePath.empty()) {
+        capture.open(capturePath, ios::trunc);
+        if (!capture.is_open()) {
+            logError("Не удалось открыть файл записи запросов: %s", capturePath.c_str());
+        }
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    RequestScheduler scheduler;
+    thread reader([&] {
+        string line;
+        while (getline(cin, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line == "quit") {
+                break;
+            }
+            chrono::steady_clock::time_point arrival = chrono::steady_clock::now();
+            if (capture.is_open()) {
+                long long offset = chrono::duration_cast<chrono::milliseconds>(arrival - start).count();
+                capture << offset << "\t" << line << "\n";
+                capture.flush();
+            }
+            scheduler.push(parseScheduledRequest(line, arrival));
+        }
+        scheduler.close();
+    });
+
+    DeadlinePlanner planner;
+    ScheduledRequest next;
+    while (scheduler.pop(next)) {
+        bool tryOn = next.line.compare(0, 6, "tryon\t") == 0;
+        RenderTier tier = RenderTier::Full;
+        bool feasible = tryOn ? planner.choose(next, tier) : !next.hasDeadline() || chrono::steady_clock::now() < next.deadline;
+        if (!feasible) {
+            engineMetrics.countDeadline(next.requestClass, DeadlineResult::Shed);
+            logWarn("Запрос отброшен, срок не выполнить: %s", next.line.c_str());
+            emitEvent(isScrubRequest(next.line) ? "scrub_error" : "error", "deadline");
+            continue;
+        }
+        if (tier != RenderTier::Full) {
+            emitEvent("tier", renderTierNames[static_cast<int>(tier)]);
+        }
+
+        chrono::steady_clock::time_point started = chrono::steady_clock::now();
+        // Пакетный запрос вытесняется и выполняется заново, поэтому предпросмотра у него нет: иначе клиент
+        // получил бы его дважды. Уровень PreviewOnly (один предпросмотр) не вытесняется, он и так дешев.
+        bool batch = next.requestClass == RequestClass::Batch;
+        engine.setPreemption(batch && tier != RenderTier::PreviewOnly ? &scheduler.interactiveWaiting() : nullptr);
+        handleRequestLine(engine, next.line, tier, !batch);
+        if (engine.wasPreempted()) {
+            engineMetrics.countPreempted();
+            scheduler.requeue(move(next));
+            continue;
+        }
+        chrono::steady_clock::time_point finished = chrono::steady_clock::now();
+        if (tryOn) {
+            planner.observe(tier, chrono::duration<double, milli>(finished - started).count());
+            engineMetrics.countTier(tier);
+        }
+        if (next.hasDeadline()) {
+            engineMetrics.countDeadline(next.requestClass, finished <= next.deadline ? DeadlineResult::Met : DeadlineResult::Missed);
+        }
+        if (!metricsPath.empty()) {
+            engineMetrics.writeFile(metricsPath);
+        }
+    }
+    reader.join();
+}
+
+// --- Нагрузочный тест (--loadgen) и воспроизведение записи (--replay) ---
+// Несколько движков в одном процессе берут строки запросов из общей очереди и выполняют
+// их так же, как режим сервера. Задержка считается от постановки в очередь, то есть
+// включает ожидание свободного движка.
+//   --loadgen <корпус>: строки фото<TAB>одежда<TAB>тип (как манифест --batch).
+//     --concurrency <n> пользователей; без --rate каждый ждет ответа и сразу шлет следующий
+//     запрос (замкнутый цикл), с --rate <r> запросы приходят пуассоновским потоком r в секунду,
+//     а при n запросах в работе новые отбрасываются. --duration <с> - длительность теста.
+//   --replay <запись>: строки из --capture в записанном темпе, ускоренном в --speed раз.
+//   --engines <m> - число движков (для --replay по умолчанию 1, чтобы сеансы шли по порядку).
+struct LoadRequest {
+    string line;
+    chrono::steady_clock::time_point queuedAt;
+    shared_ptr<promise<bool>> done; // для замкнутого цикла, иначе пустой
+};
+
+class LoadTestRunner {
+public:
+    LoadTestRunner(const string& modelPath, const string& protoPath, int engineCount, bool multiPerson, BlendMode blendMode) {
+        for (int i = 0; i < engineCount; ++i) {
+            unique_ptr<TryOnEngine> engine(new TryOnEngine());
+            if (!engine->load(modelPath, protoPath)) {
+                engines.clear();
+                return;
+            }
+            engine->setOutputPrefix("loadgen_" + to_string(i) + "_");
+            engine->setMultiPerson(multiPerson);
+            engine->setBlendMode(blendMode);
+            engine->warmUp(1);
+            engines.push_back(move(engine));
+        }
+    }
+
+    bool ready() const {
+        return !engines.empty();
+    }
+
+    void start() {
+        startedAt = chrono::steady_clock::now();
+        for (size_t i = 0; i < engines.size(); ++i) {
+            workers.emplace_back([this, i] { workerLoop(*engines[i]); });
+        }
+    }
+
+    // false, если в работе уже maxInFlight запросов (запрос отброшен)
+    bool submit(const string& line, shared_ptr<promise<bool>> done, int maxInFlight) {
+        if (maxInFlight > 0 && inFlight.load() >= maxInFlight) {
+            ++dropped;
+            return false;
+        }
+        ++inFlight;
+        lock_guard<mutex> lock(queueMutex);
+        queue.push_back({ line, chrono::steady_clock::now(), move(done) });
+        queueCondition.notify_one();
+        return true;
+    }
+
+    // Дожидается выполнения всех принятых запросов и печатает отчет
+    void finish() {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueCondition.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - startedAt).count();
+
+        sort(latencies.begin(), latencies.end());
+        auto percentile = [this](double p) {
+            if (latencies.empty()) {
+                return 0.0;
+            }
+            size_t rank = static_cast<size_t>(ceil(p * latencies.size()));
+            return latencies[max<size_t>(rank, 1) - 1];
+        };
+        cout << "Запросов: " << latencies.size() << ", ошибок: " << failed << ", отброшено: " << dropped.load()
+            << ", движков: " << engines.size() << endl;
+        cout << "Пропускная способность: " << (elapsed > 0 ? latencies.size() / elapsed : 0.0) << " запросов/с за " << elapsed << " с" << endl;
+        cout << "Задержка, мс: p50=" << percentile(0.50) << " p95=" << percentile(0.95) << " p99=" << percentile(0.99)
+            << " max=" << (latencies.empty() ? 0.0 : latencies.back()) << endl;
+    }
+
+private:
+    void workerLoop(TryOnEngine& engine) {
+        while (true) {
+            LoadRequest request;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                request = move(queue.front());
+                queue.pop_front();
+            }
+            bool ok = handleRequestLine(engine, parseScheduledRequest(request.line, request.queuedAt).line);
+            double latency = chrono::duration<double, milli>(chrono::steady_clock::now() - request.queuedAt).count();
+            {
+                lock_guard<mutex> lock(resultMutex);
+                latencies.push_back(latency);
+                failed += ok ? 0 : 1;
+            }
+            --inFlight;
+            if (request.done) {
+                request.done->set_value(ok);
+            }
+        }
+    }
+
+    vector<unique_ptr<TryOnEngine>> engines;
+    vector<thread> workers;
+    deque<LoadRequest> queue;
+    mutex queueMutex;
+    condition_variable queueCondition;
+    bool stopping = false;
+    atomic<int> inFlight{ 0 };
+    atomic<long long> dropped{ 0 };
+    mutex resultMutex;
+    vector<double> latencies;
+    long long failed = 0;
+    chrono::steady_clock::time_point startedAt;
+};
+
+int runLoadGenerator(LoadTestRunner& runner, const string& corpusPath, int concurrency, double rate, double durationSeconds) {
+    vector<string> corpus;
+    {
+        ifstream corpusFile(corpusPath);
+        string line;
+        while (getline(corpusFile, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (splitFields(line, '\t').size() == 3) {
+                corpus.push_back("tryon\t" + line);
+            }
+        }
+    }
+    if (corpus.empty()) {
+        logError("Корпус пуст или не найден: %s", corpusPath.c_str());
+        return -1;
+    }
+
+    runner.start();
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() +
+        chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(durationSeconds));
+    if (rate > 0) {
+        // Открытый цикл: интервалы между запросами экспоненциальные
+        mt19937 random(12345);
+        exponential_distribution<double> interval(rate);
+        uniform_int_distribution<size_t> pick(0, corpus.size() - 1);
+        chrono::steady_clock::time_point next = chrono::steady_clock::now();
+        while (next < deadline) {
+            this_thread::sleep_until(next);
+            runner.submit(corpus[pick(random)], nullptr, concurrency);
+            next += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(interval(random)));
+        }
+    }
+    else {
+        // Замкнутый цикл: concurrency пользователей, у каждого не больше одного запроса в работе
+        vector<thread> users;
+        for (int u = 0; u < concurrency; ++u) {
+            users.emplace_back([&runner, &corpus, deadline, u] {
+                mt19937 random(static_cast<unsigned>(u + 1));
+                uniform_int_distribution<size_t> pick(0, corpus.size() - 1);
+                while (chrono::steady_clock::now() < deadline) {
+                    auto done = make_shared<promise<bool>>();
+                    future<bool> result = done->get_future();
+                    runner.submit(corpus[pick(random)], done, 0);
+                    result.wait();
+                }
+            });
+        }
+        for (thread& user : users) {
+            user.join();
+        }
+    }
+    runner.finish();
+    return 0;
+}
+
+int runReplay(LoadTestRunner& runner, const string& capturePath, double speed) {
+    ifstream captureFile(capturePath);
+    if (!captureFile.is_open()) {
+        logError("Не удалось открыть запись запросов: %s", capturePath.c_str());
+        return -1;
+    }
+    if (speed <= 0) {
+        speed = 1.0;
+    }
+    runner.start();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    string line;
+    while (getline(captureFile, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        size_t separator = line.find('\t');
+        if (separator == string::npos) {
+            continue;
+        }
+        double offsetMs = atof(line.substr(0, separator).c_str()) / speed;
+        this_thread::sleep_until(start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(offsetMs)));
+        runner.submit(line.substr(separator + 1), nullptr, 0);
+    }
+    runner.finish();
+    return 0;
+}
+
+// --- Пакетный режим (--batch) ---
+// Манифест: в каждой строке фото<TAB>одежда<TAB>тип одежды. Три стадии работают одновременно:
+// пул потоков заранее декодирует фото, основной поток считает сеть и наложение,
+// отдельный поток пишет JPEG. Очереди между стадиями ограничены, поэтому память
+// не зависит от размера манифеста. Номер каждой записанной строки дописывается в
+// <out>/batch_checkpoint.txt, после падения работа продолжается со следующей строки.
+
+// Очередь фиксированной емкости: push ждет места, pop ждет элемента или закрытия
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    void push(T item) {
+        unique_lock<mutex> lock(m);
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& item) {
+        unique_lock<mutex> lock(m);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(m);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    deque<T> items;
+    bool closed = false;
+    mutex m;
+    condition_variable notEmpty;
+    condition_variable notFull;
+};
+
+struct BatchJob {
+    long long index = 0;
+    string clothPath;
+    string clothingType;
+    string outputPath;
+    shared_future<Mat> person; // декодируется в пуле
+};
+
+struct BatchWrite {
+    long long index = 0;
+    string outputPath;
+    Mat frame;   // буфер из пула кадров; пустой, если запрос не удался
+    bool ok = false;
+};
+
+// Номер последней записанной строки манифеста, -1 если чекпоинта нет
+long long readBatchCheckpoint(const string& checkpointPath) {
+    ifstream checkpointFile(checkpointPath);
+    long long last = -1;
+    string line;
+    while (getline(checkpointFile, line)) {
+        if (!line.empty()) {
+            last = max(last, atoll(line.c_str()));
+        }
+    }
+    return last;
+}
+
+int runBatchMode(TryOnEngine& engine, const string& manifestPath, const string& outputDir, const string& metricsPath) {
+    ifstream manifest(manifestPath);
+    if (!manifest.is_open()) {
+        logError("Не удалось открыть манифест: %s", manifestPath.c_str());
+        return -1;
+    }
+    fs::create_directories(outputDir);
+    string checkpointPath = (fs::path(outputDir) / "batch_checkpoint.txt").string();
+    long long resumeAfter = readBatchCheckpoint(checkpointPath);
+    if (resumeAfter >= 0) {
+        emitEvent("resume", to_string(resumeAfter + 1));
+    }
+
+    WorkStealingPool decodePool;
+    const size_t decodeWindow = 2 * decodePool.size(); // сколько фото может быть декодировано наперед
+    const size_t frameBuffers = 4;                      // сколько готовых кадров может ждать записи
+    BoundedQueue<BatchJob> decoded(decodeWindow);
+    BoundedQueue<BatchWrite> pendingWrites(frameBuffers);
+    BoundedQueue<Mat> freeFrames(frameBuffers);
+    for (size_t i = 0; i < frameBuffers; ++i) {
+        freeFrames.push(Mat());
+    }
+
+    // Чтение манифеста: каждая строка сразу уходит на декодирование в пул
+    thread reader([&] {
+        string line;
+        long long index = -1;
+        while (getline(manifest, line)) {
+            ++index;
+            if (index <= resumeAfter) {
+                continue;
+            }
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            vector<string> fields = splitFields(line, '\t');
+            BatchJob job;
+            job.index = index;
+            if (fields.size() == 3) {
+                job.clothPath = fields[1];
+                job.clothingType = fields[2];
+                job.outputPath = (fs::path(outputDir) / (to_string(index) + "_" + fs::path(fields[0]).stem().string() + "_" +
+                    fs::path(fields[1]).stem().string() + ".jpg")).string();
+            }
+            else {
+                logError("Неверная строка манифеста %lld: %s", index, line.c_str());
+            }
+
+            auto photo = make_shared<promise<Mat>>();
+            job.person = photo->get_future().share();
+            if (fields.size() == 3) {
+                string photoPath = fields[0];
+                decodePool.submit([photo, photoPath] {
+                    StageTimer timer(Stage::Decode);
+                    photo->set_value(imread(photoPath));
+                });
+            }
+            else {
+                photo->set_value(Mat());
+            }
+            decoded.push(move(job));
+        }
+        decoded.close();
+    });
+
+    // Запись результатов по порядку манифеста, поэтому чекпоинт - просто номер строки
+    atomic<long long> written{ 0 }, failed{ 0 };
+    thread writer([&] {
+        ofstream checkpointFile(checkpointPath, ios::app);
+        BatchWrite write;
+        while (pendingWrites.pop(write)) {
+            bool ok = write.ok;
+            if (ok) {
+                StageTimer timer(Stage::Encode);
+                ok = writeImageAtomically(write.outputPath, write.frame, 95);
+            }
+            ++(ok ? written : failed);
+            checkpointFile << write.index << "\n";
+            checkpointFile.flush();
+            freeFrames.push(move(write.frame));
+
+            long long done = written.load() + failed.load();
+            if (done % 100 == 0) {
+                emitEvent("progress", to_string(done));
+                if (!metricsPath.empty()) {
+                    engineMetrics.writeFile(metricsPath);
+                }
+            }
+        }
+    });
+
+    // Сеть и наложение в основном потоке: движок один, его буферы не делятся между потоками
+    BatchJob job;
+    while (decoded.pop(job)) {
+        const Mat& person = job.person.get();
+        BatchWrite write;
+        write.index = job.index;
+        write.outputPath = job.outputPath;
+        freeFrames.pop(write.frame);
+        Mat output;
+        if (person.empty()) {
+            if (!job.outputPath.empty()) {
+                logError("Не удалось загрузить изображение в строке %lld", job.index);
+            }
+        }
+        else if (engine.renderFullFrame(person, job.clothPath, job.clothingType, output)) {
+            output.copyTo(write.frame); // кадр движка перезапишется следующим запросом
+            write.ok = true;
+        }
+        pendingWrites.push(move(write));
+    }
+    pendingWrites.close();
+
+    reader.join();
+    writer.join();
+    if (!metricsPath.empty()) {
+        engineMetrics.writeFile(metricsPath);
+    }
+    cout << "Записано: " << written.load() << ", с ошибками: " << failed.load() << endl;
+    return failed.load() == 0 ? 0 : 1;
+}
+
+// --- Видео (--video) ---
+// Одевает каждый кадр видео и пишет рядом с ним дорожку поз (<видео>.pose). С --reuse-track
+// сеть не загружается: ключевые точки берутся из дорожки, остаются декодирование, наложение
+// и кодирование. Кодирование идет в отдельном потоке, кадры ждут его в ограниченной очереди.
+int runVideoMode(TryOnEngine& engine, const string& videoPath, const string& clothPath, const string& clothingType,
+    const string& outputPath, bool reuseTrack, const string& metricsPath) {
+    VideoCapture capture(videoPath);
+    if (!capture.isOpened()) {
+        logError("Не удалось открыть видео: %s", videoPath.c_str());
+        return -1;
+    }
+    Size frameSize(static_cast<int>(capture.get(CAP_PROP_FRAME_WIDTH)), static_cast<int>(capture.get(CAP_PROP_FRAME_HEIGHT)));
+    double fps = capture.get(CAP_PROP_FPS);
+    if (fps <= 0) {
+        fps = 25.0;
+    }
+
+    string trackPath = poseTrackPath(videoPath);
+    PoseTrackReader trackReader;
+    PoseTrackWriter trackWriter;
+    if (reuseTrack) {
+        if (!trackReader.open(trackPath)) {
+            return -1;
+        }
+        if (trackReader.frameSize != frameSize) {
+            logError("Дорожка поз снята с другого размера кадра: %s", trackPath.c_str());
+            return -1;
+        }
+    }
+    else if (!trackWriter.open(trackPath, frameSize, fps)) {
+        return -1;
+    }
+
+    VideoWriter videoWriter(outputPath, VideoWriter::fourcc('m', 'p', '4', 'v'), fps, frameSize);
+    if (!videoWriter.isOpened()) {
+        logError("Не удалось создать видео: %s", outputPath.c_str());
+        return -1;
+    }
+
+    const size_t frameBuffers = 4;
+    BoundedQueue<Mat> pendingFrames(frameBuffers);
+    BoundedQueue<Mat> freeFrames(frameBuffers);
+    for (size_t i = 0; i < frameBuffers; ++i) {
+        freeFrames.push(Mat());
+    }
+    thread encoder([&] {
+        Mat frame;
+        while (pendingFrames.pop(frame)) {
+            {
+                StageTimer timer(Stage::Encode);
+                videoWriter.write(frame);
+            }
+            freeFrames.push(move(frame));
+        }
+    });
+
+    long long frames = 0, undressed = 0;
+    bool trackEnded = false;
+    Mat source;
+    PoseFrame pose;
+    while (true) {
+        {
+            StageTimer timer(Stage::Decode);
+            if (!capture.read(source)) {
+                break;
+            }
+        }
+        if (reuseTrack && !trackReader.read(pose)) {
+            trackEnded = true;
+            break;
+        }
+
+        Mat output;
+        bool dressed = engine.renderFullFrame(source, clothPath, clothingType, output, reuseTrack ? &pose : nullptr);
+        if (!reuseTrack) {
+            engine.lastPose(pose);
+            trackWriter.write(pose);
+        }
+        Mat frame;
+        freeFrames.pop(frame);
+        (dressed ? output : source).copyTo(frame); // кадр движка перезапишется следующим запросом
+        pendingFrames.push(move(frame));
+
+        ++frames;
+        undressed += dressed ? 0 : 1;
+        if (frames % 100 == 0) {
+            emitEvent("progress", to_string(frames));
+            if (!metricsPath.empty()) {
+                engineMetrics.writeFile(metricsPath);
+            }
+        }
+    }
+    pendingFrames.close();
+    encoder.join();
+    videoWriter.release();
+
+    if (!metricsPath.empty()) {
+        engineMetrics.writeFile(metricsPath);
+    }
+    if (trackEnded) {
+        logError("Дорожка поз короче видео, обработано кадров: %lld", frames);
+        return -1;
+    }
+    if (!reuseTrack) {
+        if (!trackWriter.close()) {
+            return -1;
+        }
+        emitEvent("track", trackPath);
+    }
+    emitEvent("video", outputPath);
+    cout << "Кадров: " << frames << ", без одежды: " << undressed << endl;
+    return 0;
+}
+
+// --- Замер ранних выходов сети (--bench-exits) ---
+// Для каждого фото из списка сравнивает ключевые точки каждого промежуточного выхода с полной
+// сетью: время forward, средняя ошибка положения (в % от диагонали фото), доля найденных точек
+// и для каждого типа одежды - как часто выход принимается при пороге threshold.
+struct ExitStats {
+    string layer;
+    double totalMs = 0;
+    double errorSum = 0;   // сумма ошибок в долях диагонали
+    int errorCount = 0;
+    int found = 0;         // точки, найденные и полной сетью, и выходом
+    int reference = 0;     // точки, найденные полной сетью
+    vector<int> accepted;  // по типам одежды из clothingRules
+};
+
+int runExitBenchmark(const string& modelPath, const string& protoPath, const string& listPath, float threshold) {
+    Net net = loadPoseNet(modelPath, protoPath);
+    if (net.empty()) {
+        return -1;
+    }
+    ifstream list(listPath);
+    if (!list.is_open()) {
+        logError("Не удалось открыть список фото: %s", listPath.c_str());
+        return -1;
+    }
+
+    const Size inputSize(368, 368);
+    vector<string> exits = findHeatmapExits(net, inputSize);
+    exits.push_back(""); // полная сеть, для сравнения в той же таблице
+    vector<ExitStats> stats(exits.size());
+    for (size_t e = 0; e < exits.size(); ++e) {
+        stats[e].layer = exits[e].empty() ? "full" : exits[e];
+        stats[e].accepted.assign(clothingRules.size(), 0);
+    }
+
+    int photos = 0;
+    string photoPath;
+    vector<Point> reference, keypoints;
+    vector<float> confidences;
+    while (getline(list, photoPath)) {
+        if (!photoPath.empty() && photoPath.back() == '\r') {
+            photoPath.pop_back();
+        }
+        Mat person = imread(photoPath);
+        if (person.empty()) {
+            logError("Не удалось загрузить изображение: %s", photoPath.c_str());
+            continue;
+        }
+        Mat blob;
+        blobFromImage(person, blob, 1.0 / 255.0, inputSize, Scalar(0, 0, 0), true, false);
+        if (photos == 0) {
+            // Первый forward не в счет: в нем OpenCV выделяет буферы слоев
+            net.setInput(blob);
+            net.forward();
+        }
+        ++photos;
+        double diagonal = sqrt(static_cast<double>(person.cols) * person.cols + static_cast<double>(person.rows) * person.rows);
+
+        // Полная сеть идет последней в exits, но эталон нужен раньше
+        net.setInput(blob);
+        extractKeypoints(net.forward(), person.size(), reference);
+
+        for (size_t e = 0; e < exits.size(); ++e) {
+            TickMeter timer;
+            timer.start();
+            net.setInput(blob);
+            Mat output = exits[e].empty() ? net.forward() : net.forward(exits[e]);
+            timer.stop();
+            extractKeypoints(output, person.size(), keypoints, &confidences);
+
+            ExitStats& exit = stats[e];
+            exit.totalMs += timer.getTimeMilli();
+            for (size_t k = 0; k < reference.size(); ++k) {
+                if (reference[k].x == -1) {
+                    continue;
+                }
+                ++exit.reference;
+                if (keypoints[k].x == -1) {
+                    continue;
+                }
+                ++exit.found;
+                Point delta = keypoints[k] - reference[k];
+                exit.errorSum += sqrt(static_cast<double>(delta.dot(delta))) / diagonal;
+                ++exit.errorCount;
+            }
+            for (size_t r = 0; r < clothingRules.size(); ++r) {
+                exit.accepted[r] += anchorsConfident(clothingRules[r], confidences, threshold) ? 1 : 0;
+            }
+        }
+    }
+    if (photos == 0) {
+        logError("В списке нет ни одного фото");
+        return -1;
+    }
+
+    cout << "Фото: " << photos << ", порог уверенности: " << threshold << endl;
+    for (const ExitStats& exit : stats) {
+        cout << exit.layer
+            << "\tms=" << exit.totalMs / photos
+            << "\terror%=" << (exit.errorCount > 0 ? 100.0 * exit.errorSum / exit.errorCount : 0.0)
+            << "\trecall=" << (exit.reference > 0 ? static_cast<double>(exit.found) / exit.reference : 0.0);
+        for (size_t r = 0; r < clothingRules.size(); ++r) {
+            cout << "\t" << clothingRules[r].type << "=" << static_cast<double>(exit.accepted[r]) / photos;
+        }
+        cout << endl;
+    }
+    return 0;
+}
+
+// --- Замер точного режима (--bench-precision) ---
+// Для каждого фото время forward трех вариантов: обычный режим (один масштаб 368x368), точный
+// режим одним пакетом Nx3xSxS, как в setPrecision (меньшие масштабы дополнены серым до SxS), и те же
+// масштабы по очереди, каждый на своем квадрате без дополнения. Пакет считает N полных квадратов,
+// очередь - только их площадь, зато платит накладные расходы forward N раз.
+int runPrecisionBenchmark(const string& modelPath, const string& protoPath, const string& listPath,
+    int scaleCount, int side) {
+    vector<double> scales = precisionScaleList(scaleCount, 0.25);
+    if (scales.size() < 2) {
+        logError("Для замера точного режима нужно хотя бы 2 масштаба (--precision <n>)");
+        return -1;
+    }
+    Net net = loadPoseNet(modelPath, protoPath);
+    if (net.empty()) {
+        return -1;
     }
-
-    if (foreground.channels() != 4) {
-        cerr << "[ERROR] Изображение одежды должно иметь 4 канала (RGBA)!" << endl;
-        return background.clone();
+    ifstream list(listPath);
+    if (!list.is_open()) {
+        logError("Не удалось открыть список фото: %s", listPath.c_str());
+        return -1;
     }
 
-    Mat output = background.clone();
-    Mat resizedItem;
-    resize(foreground, resizedItem, itemSize);
-
-    for (int y = 0; y < resizedItem.rows; ++y) {
-        for (int x = 0; x < resizedItem.cols; ++x) {
-            int bgY = location.y + y;
-            int bgX = location.x + x;
+    const int count = static_cast<int>(scales.size());
+    const int batchSizes[] = { count, 3, side, side };
+    Mat single, batch(4, batchSizes, CV_32F);
+    vector<Mat> sequential(count);
+    double singleMs = 0, batchMs = 0, sequentialMs = 0;
+    int photos = 0;
+    string photoPath;
 
-            if (bgY >= 0 && bgY < background.rows && bgX >= 0 && bgX < background.cols) {
-                Vec4b fgPixel = resizedItem.at<Vec4b>(y, x);
-                Vec3b& bgPixel = output.at<Vec3b>(bgY, bgX);
+    cout << "фото	один масштаб мс	пакет мс	по очереди мс" << endl;
+    while (getline(list, photoPath)) {
+        if (!photoPath.empty() && photoPath.back() == '\r') {
+            photoPath.pop_back();
+        }
+        Mat person = imread(photoPath);
+        if (person.empty()) {
+            logError("Не удалось загрузить изображение: %s", photoPath.c_str());
+            continue;
+        }
+        blobFromImage(person, single, 1.0 / 255.0, Size(368, 368), Scalar(0, 0, 0), true, false);
+        batch.setTo(Scalar(0.5));
+        for (int k = 0; k < count; ++k) {
+            int scaledSide = max(1, cvRound(side * scales[k]));
+            blobFromImage(person, sequential[k], 1.0 / 255.0, Size(scaledSide, scaledSide), Scalar(0, 0, 0), true, false);
+            for (int c = 0; c < 3; ++c) {
+                Mat plane(side, side, CV_32F, batch.ptr(k, c));
+                Mat(scaledSide, scaledSide, CV_32F, sequential[k].ptr(0, c)).copyTo(plane(Rect(0, 0, scaledSide, scaledSide)));
+            }
+        }
 
-                float alpha = fgPixel[3] / 255.0f;
-                for (int c = 0; c < 3; ++c) {
-                    bgPixel[c] = saturate_cast<uchar>(alpha * fgPixel[c] + (1.0f - alpha) * bgPixel[c]);
-                }
+        // Первый forward каждой формы входа не в счет: в нем OpenCV выделяет буферы слоев
+        TickMeter singleTimer, batchTimer, sequentialTimer;
+        for (int pass = 0; pass < 2; ++pass) {
+            if (pass == 1) {
+                singleTimer.start();
+            }
+            net.setInput(single);
+            net.forward();
+            if (pass == 1) {
+                singleTimer.stop();
+                batchTimer.start();
+            }
+            net.setInput(batch);
+            net.forward();
+            if (pass == 1) {
+                batchTimer.stop();
+                sequentialTimer.start();
+            }
+            for (int k = 0; k < count; ++k) {
+                net.setInput(sequential[k]);
+                net.forward();
+            }
+            if (pass == 1) {
+                sequentialTimer.stop();
             }
         }
+        ++photos;
+        singleMs += singleTimer.getTimeMilli();
+        batchMs += batchTimer.getTimeMilli();
+        sequentialMs += sequentialTimer.getTimeMilli();
+        cout << photoPath << "\t" << singleTimer.getTimeMilli() << "\t" << batchTimer.getTimeMilli() << "\t"
+            << sequentialTimer.getTimeMilli() << endl;
+    }
+    if (photos == 0) {
+        logError("В списке нет ни одного фото");
+        return -1;
     }
 
-    return output;
+    cout << "Масштабов: " << count << ", сторона " << side << ", фото: " << photos << endl;
+    cout << "среднее\t" << singleMs / photos << "\t" << batchMs / photos << "\t" << sequentialMs / photos << endl;
+    cout << "пакет: x" << batchMs / singleMs << " от одного масштаба, по очереди: x" << sequentialMs / singleMs
+        << "; быстрее " << (batchMs <= sequentialMs ? "пакет" : "по очереди") << endl;
+    return 0;
 }
 
-// --- Функция обнаружения ключевых точек тела ---
-vector<Point> detectBodyKeypoints(const Mat& person, const string& modelPath, const string& protoPath) {
-    vector<Point> keypoints;
+// --- Калибровка INT8-сети (--calibrate-int8) ---
+// Фото папки (рекурсивно) делятся на калибровочные (calibrationCount штук равномерно по списку)
+// и проверочные. По калибровочным сеть квантуется, на проверочных ключевые точки INT8 сравниваются
+// с float: для каждого типа одежды фото проходит, если все опорные точки правила, найденные
+// float-сетью, нашлись и INT8-сетью не дальше tolerance % диагонали фото. INT8 разрешается
+// типу, у которого проходит не меньше int8PassRate фото. Итог пишется в outputPath для --int8.
+const double int8PassRate = 0.95;
+
+struct Int8RuleStats {
+    int photos = 0;        // фото, где float-сеть нашла хоть одну опорную точку
+    int passed = 0;
+    int lost = 0;          // опорные точки, потерянные INT8-сетью
+    double errorSum = 0;   // сумма ошибок в долях диагонали
+    int errorCount = 0;
+    double maxError = 0;
+};
 
-    Net net = readNet(modelPath, protoPath);
+int runInt8Calibration(const string& modelPath, const string& protoPath, const string& photoDir, const string& outputPath,
+    int calibrationCount, double tolerance) {
+    Net net = loadPoseNet(modelPath, protoPath);
     if (net.empty()) {
-        cerr << "[ERROR] Ошибка загрузки модели OpenPose!" << endl;
-        return keypoints;
+        return -1;
+    }
+    vector<string> photos;
+    error_code error;
+    for (fs::recursive_directory_iterator it(photoDir, error), end; !error && it != end; it.increment(error)) {
+        if (it->is_regular_file() && isImageFile(it->path())) {
+            photos.push_back(fs::absolute(it->path()).generic_string());
+        }
+    }
+    if (error || photos.empty()) {
+        logError("В папке нет фото для калибровки: %s", photoDir.c_str());
+        return -1;
     }
+    sort(photos.begin(), photos.end());
 
-    // Преобразование изображения в формат для модели
-    Mat blob;
-    blobFromImage(person, blob, 1.0 / 255.0, Size(368, 368), Scalar(0, 0, 0), true, false);
-    net.setInput(blob);
-    Mat output = net.forward();
+    vector<string> calibrationPhotos, checkPhotos;
+    size_t step = max<size_t>(1, photos.size() / max(1, calibrationCount));
+    for (size_t i = 0; i < photos.size(); ++i) {
+        bool calibration = i % step == 0 && calibrationPhotos.size() < static_cast<size_t>(calibrationCount);
+        (calibration ? calibrationPhotos : checkPhotos).push_back(photos[i]);
+    }
+    if (checkPhotos.empty()) {
+        logWarn("Все фото ушли на калибровку, точность проверяется на них же");
+        checkPhotos = calibrationPhotos;
+    }
 
-    int H = output.size[2]; // Высота карты
-    int W = output.size[3]; // Ширина карты
+    Net int8Net = quantizePoseNet(net, calibrationPhotos);
+    if (int8Net.empty()) {
+        return -1;
+    }
 
-    const int NUM_KEYPOINTS = 25;
-    for (int i = 0; i < NUM_KEYPOINTS; ++i) {
-        Mat heatMap(H, W, CV_32F, output.ptr(0, i));
-        Point maxLoc;
-        double maxVal;
+    vector<Int8RuleStats> stats(clothingRules.size());
+    double floatMs = 0, int8Ms = 0;
+    int checked = 0;
+    Mat blob;
+    BlobScratch scratch;
+    vector<Point> reference, keypoints;
+    for (const string& photoPath : checkPhotos) {
+        Size photoSize;
+        if (!calibrationBlob(photoPath, blob, scratch, &photoSize)) {
+            continue;
+        }
+        if (checked == 0) {
+            // Первый forward не в счет: в нем OpenCV выделяет буферы слоев
+            net.setInput(blob);
+            net.forward();
+            int8Net.setInput(blob);
+            int8Net.forward();
+        }
+        ++checked;
+        double diagonal = sqrt(static_cast<double>(photoSize.width) * photoSize.width + static_cast<double>(photoSize.height) * photoSize.height);
 
-        minMaxLoc(heatMap, 0, &maxVal, 0, &maxLoc);
+        TickMeter floatTimer, int8Timer;
+        floatTimer.start();
+        net.setInput(blob);
+        Mat floatOutput = net.forward();
+        floatTimer.stop();
+        extractKeypoints(floatOutput, photoSize, reference);
+        int8Timer.start();
+        int8Net.setInput(blob);
+        Mat int8Output = int8Net.forward();
+        int8Timer.stop();
+        extractKeypoints(int8Output, photoSize, keypoints);
+        floatMs += floatTimer.getTimeMilli();
+        int8Ms += int8Timer.getTimeMilli();
 
-        if (maxVal > 0.1) { // Уверенность > 0.1
-            keypoints.push_back(Point(static_cast<int>(maxLoc.x * person.cols / W),
-                static_cast<int>(maxLoc.y * person.rows / H)));
-        }
-        else {
-            keypoints.push_back(Point(-1, -1));
+        for (size_t r = 0; r < clothingRules.size(); ++r) {
+            Int8RuleStats& rule = stats[r];
+            bool any = false, pass = true;
+            for (int anchor : clothingRules[r].anchors) {
+                if (reference[anchor].x == -1) {
+                    continue;
+                }
+                any = true;
+                if (keypoints[anchor].x == -1) {
+                    ++rule.lost;
+                    pass = false;
+                    continue;
+                }
+                Point delta = keypoints[anchor] - reference[anchor];
+                double anchorError = sqrt(static_cast<double>(delta.dot(delta))) / diagonal;
+                rule.errorSum += anchorError;
+                ++rule.errorCount;
+                rule.maxError = max(rule.maxError, anchorError);
+                pass = pass && anchorError * 100.0 <= tolerance;
+            }
+            if (any) {
+                ++rule.photos;
+                rule.passed += pass ? 1 : 0;
+            }
         }
     }
+    if (checked == 0) {
+        logError("Ни одно проверочное фото не загрузилось");
+        return -1;
+    }
 
-    return keypoints;
+    ofstream output(outputPath);
+    if (!output.is_open()) {
+        logError("Не удалось записать файл калибровки: %s", outputPath.c_str());
+        return -1;
+    }
+    for (const string& photo : calibrationPhotos) {
+        output << "photo\t" << photo << "\n";
+    }
+    cout << "Фото калибровки: " << calibrationPhotos.size() << ", проверки: " << checked << ", допуск: " << tolerance << "% диагонали" << endl;
+    cout << "float ms=" << floatMs / checked << "\tint8 ms=" << int8Ms / checked << endl;
+    cout << "одежда\tфото\tв допуске\tср. ошибка %\tмакс. ошибка %\tпотеряно точек\tINT8" << endl;
+    for (size_t r = 0; r < clothingRules.size(); ++r) {
+        const Int8RuleStats& rule = stats[r];
+        double passRate = rule.photos > 0 ? static_cast<double>(rule.passed) / rule.photos : 0.0;
+        bool approved = rule.photos > 0 && passRate >= int8PassRate;
+        output << "type\t" << clothingRules[r].type << "\t" << (approved ? 1 : 0) << "\n";
+        cout << clothingRules[r].type << "\t" << rule.photos << "\t" << passRate
+            << "\t" << (rule.errorCount > 0 ? 100.0 * rule.errorSum / rule.errorCount : 0.0)
+            << "\t" << 100.0 * rule.maxError << "\t" << rule.lost << "\t" << (approved ? "да" : "нет") << endl;
+    }
+    output.close();
+    if (!output) {
+        logError("Не удалось записать файл калибровки: %s", outputPath.c_str());
+        return -1;
+    }
+    emitEvent("int8", outputPath);
+    return 0;
 }
 
-// --- Функция вычисления положения и размера майки ---
-template <typename T>
-constexpr const T& clamp(const T& value, const T& low, const T& high) {
-    return (value < low) ? low : (value > high) ? high : value;
-}
-Point calculateTshirtPosition(vector<Point>& keypoints, Size tshirtSize) {
-    if (keypoints[1].x == -1 || keypoints[1].y == -1 ||
-        keypoints[2].x == -1 || keypoints[5].x == -1) {
-        cerr << "[ERROR] Точки шеи или плеч не обнаружены!" << endl;
-        return Point(0, 0);
+// --- Проверка подготовки входа сети (--check-blob) ---
+// Для каждого фото из списка сравнивает fusedBlobFromImage с blobFromImage: наибольшая разница,
+// доля отличающихся значений, время обоих способов и ускорение; в конце - среднее по всем фото.
+// Код возврата 1, если результаты разошлись (больше округления float).
+int runBlobCheck(const string& listPath) {
+    ifstream list(listPath);
+    if (!list.is_open()) {
+        logError("Не удалось открыть список фото: %s", listPath.c_str());
+        return -1;
     }
+    const int runs = 20;
+    const double tolerance = 1e-6;
+    const int inputSizes[] = { 1, 3, 368, 368 };
+    Mat fused(4, inputSizes, CV_32F);
+    Mat reference;
+    BlobScratch scratch;
+    bool passed = true;
+    double referenceTotalMs = 0, fusedTotalMs = 0;
+    int photos = 0;
 
-    // Изменено: располагем майку выше и по центру между плечами
-    //int x = keypoints[8].y - tshirtSize.width / 2.75; // Центр по тазу
-    int x = ((keypoints[8].x + keypoints[16].x) / 2 - tshirtSize.width / 2); // Центр по тазу
-    int y = keypoints[1].y - tshirtSize.height / 10; // Изменено: выше шеи
-    return Point(x, y);
-}
+    cout << "фото\tразмер\tмакс. разница\tотличий %\tblobFromImage мс\tслитно мс\tускорение" << endl;
+    string photoPath;
+    while (getline(list, photoPath)) {
+        if (!photoPath.empty() && photoPath.back() == '\r') {
+            photoPath.pop_back();
+        }
+        Mat person = imread(photoPath);
+        if (person.empty()) {
+            logError("Не удалось загрузить изображение: %s", photoPath.c_str());
+            continue;
+        }
+        // Первые вызовы не в счет: в них выделяются буферы обоих способов
+        blobFromImage(person, reference, 1.0 / 255.0, Size(inputSizes[3], inputSizes[2]), Scalar(0, 0, 0), true, false);
+        fusedBlobFromImage(person, fused, scratch);
+        TickMeter referenceTimer, fusedTimer;
+        for (int i = 0; i < runs; ++i) {
+            referenceTimer.start();
+            blobFromImage(person, reference, 1.0 / 255.0, Size(inputSizes[3], inputSizes[2]), Scalar(0, 0, 0), true, false);
+            referenceTimer.stop();
+            fusedTimer.start();
+            fusedBlobFromImage(person, fused, scratch);
+            fusedTimer.stop();
+        }
 
-Size calculateTshirtSize(vector<Point>& keypoints, const Mat& tshirt) {
-    if (keypoints[2].x == -1 || keypoints[5].x == -1 ||
-        keypoints[8].x == -1 || keypoints[8].y == -1) {
-        cerr << "[ERROR] Точки плеч или таза не обнаружены! Используется стандартный размер одежды." << endl;
-        return Size(tshirt.cols, tshirt.rows);
-    }
+        int total = static_cast<int>(fused.total());
+        Mat referenceValues(1, total, CV_32F, reference.ptr<float>());
+        Mat fusedValues(1, total, CV_32F, fused.ptr<float>());
+        Mat difference;
+        absdiff(referenceValues, fusedValues, difference);
+        double maxDifference = 0;
+        minMaxLoc(difference, nullptr, &maxDifference);
+        double differing = 100.0 * countNonZero(difference > tolerance) / total;
+        passed = passed && maxDifference <= tolerance;
 
-    // Изменено: увеличиваем ширину майки
-    int bodyWidth = abs(keypoints[5].x - keypoints[2].x); // Расстояние между плечами
-    int bodyHeight = abs(keypoints[8].y - keypoints[1].y); // Высота от шеи до таза
+        double referenceMs = referenceTimer.getTimeMilli() / runs;
+        double fusedMs = fusedTimer.getTimeMilli() / runs;
+        referenceTotalMs += referenceMs;
+        fusedTotalMs += fusedMs;
+        ++photos;
+        cout << photoPath << "\t" << person.cols << "x" << person.rows << "\t" << maxDifference << "\t" << differing << "\t"
+            << referenceMs << "\t" << fusedMs << "\t" << (fusedMs > 0 ? referenceMs / fusedMs : 0.0) << endl;
+    }
+    if (photos > 0) {
+        cout << "среднее\t\t\t\t" << referenceTotalMs / photos << "\t" << fusedTotalMs / photos << "\t"
+            << (fusedTotalMs > 0 ? referenceTotalMs / fusedTotalMs : 0.0) << endl;
+    }
+    return passed ? 0 : 1;
+}
 
-    if (bodyWidth <= 0 || bodyHeight <= 0) {
-        cerr << "[ERROR] Некорректные размеры тела! Используется стандартный размер одежды." << endl;
-        return Size(tshirt.cols, tshirt.rows);
+// --- Замер сжатого хранения одежды (--bench-packing) ---
+// Для каждой вещи каталога: память BGRA и сжатой вещи, ошибка после распаковки (PSNR цвета по
+// видимым пикселям и наибольшая ошибка альфы) и время наложения на кадр 1280x1707 без сжатия
+// (масштабирование + смешивание) и со сжатием (масштабирование с распаковкой по строкам + смешивание).
+// Несжатое наложение - опорное: если сжатое в сумме по каталогу медленнее него больше чем на
+// marginPercent процентов, замер завершается с кодом 1.
+int runPackingBenchmark(const string& catalogPath, const string& rootDir, double marginPercent) {
+    vector<CatalogEntry> entries = loadCatalog(catalogPath);
+    if (entries.empty()) {
+        return -1;
     }
+    const int runs = 20;
+    Mat frame(1707, 1280, CV_8UC3, Scalar(128, 128, 128));
+    Mat scratch, unpacked, resized, rowArena;
+    unsigned long long rawTotal = 0, packedTotal = 0;
+    double rawMsTotal = 0, packedMsTotal = 0;
 
-    // Изменено: Увеличил коэффициенты ширины и высоты
-    float scaleFactorWidth = static_cast<float>(bodyWidth) / tshirt.cols * 2.2; // Изменено: шире на 100%
-    float scaleFactorHeight = static_cast<float>(bodyHeight) / tshirt.rows * 1.2; // Высота увеличена на 20%
+    cout << "одежда\tBGRA байт\tсжато байт\tPSNR цвета дБ\tошибка альфы\tбез сжатия мс\tсо сжатием мс" << endl;
+    for (const CatalogEntry& entry : entries) {
+        string path = (fs::path(rootDir) / entry.path).string();
+        Mat garment = imread(path, IMREAD_UNCHANGED);
+        if (garment.empty() || garment.channels() != 4) {
+            logError("Одежда должна быть картинкой с 4 каналами (RGBA): %s", path.c_str());
+            continue;
+        }
+        PackedGarment packed = packGarment(garment);
+        unpacked.create(garment.size(), CV_8UC4);
+        unpackGarment(packed, unpacked);
 
-    int newWidth = static_cast<int>(tshirt.cols * scaleFactorWidth);
-    int newHeight = static_cast<int>(tshirt.rows * scaleFactorHeight);
+        // Ошибка цвета считается только там, где вещь видна
+        double squaredError = 0;
+        long long visiblePixels = 0;
+        int alphaError = 0;
+        for (int y = 0; y < garment.rows; ++y) {
+            const Vec4b* original = garment.ptr<Vec4b>(y);
+            const Vec4b* restored = unpacked.ptr<Vec4b>(y);
+            for (int x = 0; x < garment.cols; ++x) {
+                alphaError = max(alphaError, abs(original[x][3] - restored[x][3]));
+                if (original[x][3] == 0) {
+                    continue;
+                }
+                for (int c = 0; c < 3; ++c) {
+                    double d = original[x][c] - restored[x][c];
+                    squaredError += d * d;
+                }
+                ++visiblePixels;
+            }
+        }
+        double meanError = visiblePixels > 0 ? squaredError / (3.0 * visiblePixels) : 0;
+        double psnr = meanError > 0 ? 10.0 * log10(255.0 * 255.0 / meanError) : 99.0;
 
-    // Граничные проверки (оставил как было)
-    const int minSize = 50;
-    const int maxSize = 1000;
-    newWidth = clamp(newWidth, minSize, maxSize);
-    newHeight = clamp(newHeight, minSize, maxSize);
+        double itemScale = 0.4 * frame.rows / garment.rows;
+        Size itemSize(max(1, static_cast<int>(garment.cols * itemScale)), max(1, static_cast<int>(garment.rows * itemScale)));
+        Point location((frame.cols - itemSize.width) / 2, (frame.rows - itemSize.height) / 2);
+        TickMeter rawTimer, packedTimer;
+        for (int i = 0; i < runs; ++i) {
+            frame.copyTo(scratch);
+            rawTimer.start();
+            resize(garment, resized, itemSize);
+            blendResizedItem(scratch, resized, location, Range(0, scratch.rows));
+            rawTimer.stop();
 
-    return Size(newWidth, newHeight);
-}
+            frame.copyTo(scratch);
+            packedTimer.start();
+            resized.create(itemSize, CV_8UC4);
+            resizePackedGarment(packed, resized, rowArena);
+            blendResizedItem(scratch, resized, location, Range(0, scratch.rows));
+            packedTimer.stop();
+        }
 
-// --- Функция вычисления положения и размера штанов ---
-Point calculatePantsPosition(vector<Point>& keypoints, Size pantsSize) {
-    if (keypoints[8].x == -1 || keypoints[8].y == -1 ||
-        keypoints[9].x == -1 || keypoints[12].x == -1) {
-        cerr << "[ERROR] Точки таза или бедер не обнаружены!" << endl;
-        return Point(0, 0);
+        unsigned long long rawBytes = garment.total() * garment.elemSize();
+        rawTotal += rawBytes;
+        packedTotal += packed.blocks.size();
+        rawMsTotal += rawTimer.getTimeMilli() / runs;
+        packedMsTotal += packedTimer.getTimeMilli() / runs;
+        cout << entry.path << "\t" << rawBytes << "\t" << packed.blocks.size() << "\t" << psnr << "\t" << alphaError << "\t"
+            << rawTimer.getTimeMilli() / runs << "\t" << packedTimer.getTimeMilli() / runs << endl;
     }
-
-    // Положение штанов: среднее между центром головы и таза
-    int x = ((keypoints[8].x + keypoints[16].x) / 2 - pantsSize.width / 2);
-    int y = keypoints[8].y * 0.98; // Штаны начинаются от таза
-    return Point(x, y);
-}
-
-Size calculatePantsSize(vector<Point>& keypoints, const Mat& pants) {
-    if (keypoints[9].x == -1 || keypoints[12].x == -1 ||
-        keypoints[10].y == -1 || keypoints[13].y == -1) {
-        cerr << "[ERROR] Точки бедер или коленей не обнаружены! Используется стандартный размер одежды." << endl;
-        return Size(pants.cols, pants.rows);
+    if (packedTotal == 0 || rawMsTotal <= 0) {
+        return 0;
     }
+    double overheadPercent = 100.0 * (packedMsTotal - rawMsTotal) / rawMsTotal;
+    cout << "Память: в " << static_cast<double>(rawTotal) / packedTotal << " раз меньше, наложение: "
+        << showpos << overheadPercent << noshowpos << "% времени (допуск +" << marginPercent << "%)" << endl;
+    return overheadPercent <= marginPercent ? 0 : 1;
+}
 
-    // Ширина штанов: расстояние между бедрами
-    int hipWidth = abs(keypoints[5].x - keypoints[2].x);
-    // Высота штанов: расстояние от таза до коленей
-    int pantsHeight = abs(keypoints[10].y - keypoints[24].y);
-
-    if (hipWidth <= 0 || pantsHeight <= 0) {
-        cerr << "[ERROR] Некорректные размеры тела! Используется стандартный размер одежды." << endl;
-        return Size(pants.cols, pants.rows);
+// --- Функция предпросмотра всего каталога на одной позе ---
+// Поза считается один раз, затем каждая вещь накладывается на уменьшенное фото параллельно.
+vector<Mat> renderCatalogPreview(const Mat& person, const vector<Point>& keypoints, const vector<CatalogEntry>& catalog,
+    int thumbHeight, WorkStealingPool& pool) {
+    vector<Mat> thumbnails(catalog.size());
+    if (person.empty() || keypoints.empty()) {
+        return thumbnails;
     }
 
-    // Коэффициенты ширины и высоты для масштабирования штанов
-    float scaleFactorWidth = static_cast<float>(hipWidth) / pants.cols * 1.6; // Увеличение на 130%
-    float scaleFactorHeight = static_cast<float>(pantsHeight) / pants.rows * 2; // Увеличение на 130%
+    double scale = static_cast<double>(thumbHeight) / person.rows;
+    Mat smallPerson;
+    resize(person, smallPerson, Size(max(1, static_cast<int>(person.cols * scale)), thumbHeight), 0, 0, INTER_AREA);
 
-    int newWidth = static_cast<int>(pants.cols * scaleFactorWidth);
-    int newHeight = static_cast<int>(pants.rows * scaleFactorHeight);
+    pool.parallelFor(static_cast<int>(catalog.size()), [&](int i) {
+        const ClothingRule* rule = findClothingRule(catalog[i].type);
+        Mat clothingItem = imread("H:/OutfitME/outfit_me/" + catalog[i].path, IMREAD_UNCHANGED);
+        if (rule == nullptr || clothingItem.empty()) {
+            logError("Не удалось подготовить вещь каталога: %s", catalog[i].path.c_str());
+            thumbnails[i] = smallPerson.clone();
+            return;
+        }
 
-    // Граничные проверки
-    const int minSize = 50;
-    const int maxSize = 1000;
-    newWidth = clamp(newWidth, minSize, maxSize);
-    newHeight = clamp(newHeight, minSize, maxSize);
+        // Размер и положение считаем по полноразмерным точкам, затем переводим в масштаб миниатюры
+        vector<Point> points = keypoints;
+        Size itemSize = rule->calculateSize(points, clothingItem.size());
+        Point itemLocation = rule->calculatePosition(points, itemSize);
+        thumbnails[i] = overlayImageScaled(smallPerson, clothingItem, itemLocation, itemSize, scale);
+    });
 
-    return Size(newWidth, newHeight);
+    return thumbnails;
 }
 
-// --- Функция вычисления положения и размера шляпы ---
-Point calculateHatPosition(vector<Point>& keypoints, Size hatSize) {
-    if (keypoints[0].x == -1 || keypoints[0].y == -1) { // Точка головы
-        cerr << "[ERROR] Точка головы не обнаружена!" << endl;
-        return Point(0, 0);
+// --- Функция сборки контактного листа из миниатюр ---
+Mat buildContactSheet(const vector<Mat>& thumbnails, int columns) {
+    if (thumbnails.empty() || columns <= 0) {
+        return Mat();
     }
-
-    int x = keypoints[16].x - hatSize.width / 2; // Центр по голове
-    int y = keypoints[16].y - hatSize.height;   // Над головой
-    return Point(x, y);
+    int cellWidth = 0, cellHeight = 0;
+    for (const Mat& thumb : thumbnails) {
+        cellWidth = max(cellWidth, thumb.cols);
+        cellHeight = max(cellHeight, thumb.rows);
+    }
+    int rows = (static_cast<int>(thumbnails.size()) + columns - 1) / columns;
+    Mat sheet(rows * cellHeight, columns * cellWidth, CV_8UC3, Scalar(255, 255, 255));
+    for (size_t i = 0; i < thumbnails.size(); ++i) {
+        if (thumbnails[i].empty()) {
+            continue;
+        }
+        int cellX = static_cast<int>(i % columns) * cellWidth;
+        int cellY = static_cast<int>(i / columns) * cellHeight;
+        thumbnails[i].copyTo(sheet(Rect(cellX, cellY, thumbnails[i].cols, thumbnails[i].rows)));
+    }
+    return sheet;
 }
 
-Size calculateHatSize(vector<Point>& keypoints, const Mat& hat) {
-    if (keypoints[0].x == -1 || keypoints[0].y == -1 || keypoints[1].x == -1 || keypoints[1].y == -1) {
-        cerr << "[ERROR] Точки головы не обнаружены! Используется стандартный размер шляпы." << endl;
-        return Size(hat.cols, hat.rows);
+// --- Функция обработки запроса предпросмотра каталога ---
+void processCatalogRequest(const Mat& person, const string& modelPath, const string& protoPath) {
+    string catalogPath = "H:/OutfitME/outfit_me/clTest/catalog.txt";
+    vector<CatalogEntry> catalog = loadCatalog(catalogPath);
+    if (catalog.empty()) {
+        return;
     }
 
-    int headWidth = abs(keypoints[16].x - keypoints[17].x) * 2.5; // Примерная ширина головы
-    float scaleFactor = static_cast<float>(headWidth) / hat.cols;
-
-    int newWidth = static_cast<int>(hat.cols * scaleFactor);
-    int newHeight = static_cast<int>(hat.rows * scaleFactor);
+    vector<Point> keypoints = detectBodyKeypoints(person, modelPath, protoPath);
+    if (keypoints.empty()) {
+        logError("Не удалось обнаружить ключевые точки!");
+        return;
+    }
 
-    const int minSize = 50;
-    const int maxSize = 500;
-    newWidth = clamp(newWidth, minSize, maxSize);
-    newHeight = clamp(newHeight, minSize, maxSize);
+    WorkStealingPool pool;
+    const int thumbHeight = 320;
+    vector<Mat> thumbnails = renderCatalogPreview(person, keypoints, catalog, thumbHeight, pool);
 
-    return Size(newWidth, newHeight);
+    for (size_t i = 0; i < thumbnails.size(); ++i) {
+        imwrite("catalog_preview_" + to_string(i) + ".jpg", thumbnails[i]);
+    }
+    int columns = static_cast<int>(ceil(sqrt(static_cast<double>(thumbnails.size()))));
+    imwrite("catalog_preview.jpg", buildContactSheet(thumbnails, columns));
 }
 
-// --- Функция вычисления положения и размера очков ---
-Point calculateGlassesPosition(vector<Point>& keypoints, Size glassesSize) {
-    if (keypoints[1].x == -1 || keypoints[1].y == -1 || keypoints[2].x == -1 || keypoints[5].x == -1) {
-        cerr << "[ERROR] Точки глаз или головы не обнаружены!" << endl;
-        return Point(0, 0);
+// --- Главная функция (обновленная) ---
+
+string readFileToString(const string& filePath) {
+    ifstream inputFile(filePath);
+    if (!inputFile.is_open()) {
+        logError("Не удалось открыть файл: %s", filePath.c_str());
+        return "";
     }
+    string line;
+    getline(inputFile, line);
+    inputFile.close();
+    return line;
+}
 
-    int x = (keypoints[0].x + keypoints[18].x) / 2 - glassesSize.width / 2; // Центр между глазами
-    int y = keypoints[18].y - glassesSize.height / 3.5; // Чуть ниже верхней точки головы
-    return Point(x, y);
+// --- Функции разбора аргументов командной строки ---
+bool hasFlag(int argc, char* argv[], const string& flag) {
+    for (int i = 1; i < argc; ++i) {
+        if (flag == argv[i]) {
+            return true;
+        }
+    }
+    return false;
 }
 
-Size calculateGlassesSize(vector<Point>& keypoints, const Mat& glasses) {
-    if (keypoints[1].x == -1 || keypoints[2].x == -1 || keypoints[5].x == -1) {
-        cerr << "[ERROR] Точки глаз не обнаружены! Используется стандартный размер очков." << endl;
-        return Size(glasses.cols, glasses.rows);
+string optionValue(int argc, char* argv[], const string& option, const string& defaultValue = "") {
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (option == argv[i]) {
+            return argv[i + 1];
+        }
     }
+    return defaultValue;
+}
 
-    int eyeDistance = abs(keypoints[18].x - keypoints[0].x); // Расстояние между глазами
-    float scaleFactor = static_cast<float>(eyeDistance) / glasses.cols * 2.2;
+// Файл модели: путь из option, иначе fileName рядом с exe (сборка CMake на Linux), иначе
+// путь на машине разработки (сборка Visual Studio)
+string modelFileOption(int argc, char* argv[], const string& option, const string& fileName, const string& projectPath) {
+    string value = optionValue(argc, argv, option);
+    if (!value.empty()) {
+        return value;
+    }
+    error_code error;
+    fs::path besideExe = fs::absolute(argv[0], error).parent_path() / fileName;
+    if (!error && fs::exists(besideExe, error)) {
+        return besideExe.string();
+    }
+    return projectPath;
+}
 
-    int newWidth = static_cast<int>(glasses.cols * scaleFactor);
-    int newHeight = static_cast<int>(glasses.rows * scaleFactor);
+// Тесты (tests/clTestTests.cpp) включают этот файл целиком, но со своим main
+#ifndef CLTEST_NO_MAIN
+int main(int argc, char* argv[]) {
+    setlocale(LC_ALL, "Russian");
 
-    const int minSize = 30;
-    const int maxSize = 300;
-    newWidth = clamp(newWidth, minSize, maxSize);
-    newHeight = clamp(newHeight, minSize, maxSize);
+    Mat::setDefaultAllocator(&countingMatAllocator);
 
-    return Size(newWidth, newHeight);
-}
+    string logLevel = optionValue(argc, argv, "--log-level", "info");
+    logMinLevel = static_cast<int>(logLevel == "error" ? LogLevel::Error : logLevel == "warn" ? LogLevel::Warn : LogLevel::Info);
 
-// --- Функция обработки запроса из Flutter ---
-void processClothingRequest(const string& clothingType, const Mat& person, const string& modelPath, const string& protoPath) {
-    //получение фото одежды
-    string clothInput = "H:\\OutfitME\\outfit_me\\clTest\\x64\\Debug\\wearPath.txt";
-    ifstream inputFile(clothInput);
-    string buffer;
-    if (!inputFile.is_open()) {
-        cerr << "Не удалось открыть wearPath.txt!" << endl;
-        return;
-    }
-    getline(inputFile, buffer);
-    string clothPath = "H:/OutfitME/outfit_me/" + buffer; // Это значение должно быть передано из Flutter !!!!!!!!!!!!!!!!!!!!!!
+    // Режим работы: без аргументов - одна вещь, "--catalog" - предпросмотр всего каталога,
+    // "--serve" - резидентный движок, запросы из stdin.
+    // "--shm <имя>" - отдавать кадры в общую память (текстура Flutter) вместо JPEG.
+    // "--multi" - групповое фото: одежда накладывается на каждого человека.
+    // "--seamless" - многополосное смешивание краев одежды (в пределах бюджета).
+    // "--crop-person" - сеть считается по области человека, а не по всему кадру.
+    // "--log-level <error|warn|info>" - какие сообщения журнала выводить (по умолчанию все).
+    // "--precision <n> [--precision-side <сторона>]" - точный режим: n масштабов одним пакетом
+    //   (сервер, пакетный режим, видео).
+    // "--ingest <папка> [--out <папка>]" - подготовка новой одежды для каталога.
+    // "--metrics <файл>" - метрики в текстовом формате Prometheus.
+    // "--warmup <n>" - число прогревочных проходов сети в режиме сервера (по умолчанию 1).
+    // "--batch <манифест> [--out <папка>]" - пакетная перерисовка по манифесту с продолжением после сбоя.
+    // "--early-exit <слой|auto> [--exit-threshold <t>]" - тепловые карты с промежуточной стадии сети.
+    // "--bench-exits <список фото>" - замер точности и времени каждого промежуточного выхода.
+    // "--bench-precision <список фото> [--precision <n>] [--precision-side <сторона>]" - время точного
+    //   режима: один масштаб, n масштабов одним пакетом и по очереди.
+    // "--calibrate-int8 <папка фото> [--out <файл>] [--calibration-photos <n>] [--int8-tolerance <%>]" -
+    //   квантование сети по своим фото и отчет точности опорных точек INT8 против float.
+    // "--int8 <файл калибровки>" - INT8-сеть для разрешенных калибровкой типов одежды
+    //   (сервер, пакетный режим, видео).
+    // "--check-blob <список фото>" - сверка слитной подготовки входа сети с blobFromImage.
+    // "--compress-garments" - одежда в памяти хранится сжатой (каталог --watch и кэш движка).
+    // "--bench-packing <catalog.txt> [--catalog-root <папка>] [--packing-margin <%>]" - память и скорость
+    //   сжатой одежды против несжатой.
+    // "--capture <файл>" (вместе с --serve) - запись потока запросов для --replay.
+    // "--watch <catalog.txt> [--catalog-root <папка>]" (вместе с --serve) - перезагрузка каталога на лету.
+    //   Запросы сервера: "tryon", "session", "layer", "remove", "scrub" (кадр карусели, см. scrubTo),
+    //   с необязательным префиксом "interactive|batch<TAB><срок мс><TAB>" (см. parseScheduledRequest).
+    // "--loadgen <корпус>" / "--replay <запись>" - нагрузочный тест, параметры у runLoadGenerator.
+    // "--video <видео> --wear <тип> --cloth <одежда> [--out <видео>] [--reuse-track]" - одевание видео
+    //   с записью дорожки поз; с --reuse-track вместо сети используется записанная дорожка.
+    // "--model <caffemodel>", "--proto <prototxt>" - файлы сети (по умолчанию рядом с exe, см. modelFileOption).
+    string modelPath = modelFileOption(argc, argv, "--model", "pose_iter_584000.caffemodel",
+        "H:/OutfitME/outfit_me/clTest/x64/Debug/pose_iter_584000.caffemodel");
+    string protoPath = modelFileOption(argc, argv, "--proto", "pose_deploy.prototxt",
+        "H:/OutfitME/outfit_me/openpose/models/pose/body_25/pose_deploy.prototxt");
 
-    // Загружаем модель для ключевых точек
-    vector<Point> keypoints = detectBodyKeypoints(person, modelPath, protoPath);
-    if (keypoints.empty()) {
-        cerr << "[ERROR] Не удалось обнаружить ключевые точки!" << endl;
-        return;
+    string ingestSource = optionValue(argc, argv, "--ingest");
+    if (!ingestSource.empty()) {
+        return runIngestMode(ingestSource, optionValue(argc, argv, "--out", "H:/OutfitME/outfit_me/assets/ingested"));
     }
 
-    Mat clothingItem, output;
-    Size itemSize;
-    Point itemLocation;
+    string metricsPath = optionValue(argc, argv, "--metrics");
+    string earlyExit = optionValue(argc, argv, "--early-exit");
+    float exitThreshold = static_cast<float>(atof(optionValue(argc, argv, "--exit-threshold", "0.3").c_str()));
 
-    // В зависимости от запроса выбираем, что накладывать
-    if (clothingType == "tshirt") {
-        clothingItem = imread(clothPath, IMREAD_UNCHANGED);
-        itemSize = calculateTshirtSize(keypoints, clothingItem);
-        itemLocation = calculateTshirtPosition(keypoints, itemSize);
+    string catalogRoot = optionValue(argc, argv, "--catalog-root", "H:/OutfitME/outfit_me/");
+    string packingCatalog = optionValue(argc, argv, "--bench-packing");
+    if (!packingCatalog.empty()) {
+        return runPackingBenchmark(packingCatalog, catalogRoot, atof(optionValue(argc, argv, "--packing-margin", "10").c_str()));
     }
-    else if (clothingType == "pants") {
-        clothingItem = imread(clothPath, IMREAD_UNCHANGED);
-        itemSize = calculatePantsSize(keypoints, clothingItem);
-        itemLocation = calculatePantsPosition(keypoints, itemSize);
+
+    string calibrationDir = optionValue(argc, argv, "--calibrate-int8");
+    if (!calibrationDir.empty()) {
+        return runInt8Calibration(modelPath, protoPath, calibrationDir, optionValue(argc, argv, "--out", "pose_int8.txt"),
+            atoi(optionValue(argc, argv, "--calibration-photos", "16").c_str()),
+            atof(optionValue(argc, argv, "--int8-tolerance", "2").c_str()));
     }
-    else if (clothingType == "hat") {
-        clothingItem = imread(clothPath, IMREAD_UNCHANGED);
-        itemSize = calculateHatSize(keypoints, clothingItem);
-        itemLocation = calculateHatPosition(keypoints, itemSize);
+
+    string blobCheckList = optionValue(argc, argv, "--check-blob");
+    if (!blobCheckList.empty()) {
+        return runBlobCheck(blobCheckList);
     }
-    else if (clothingType == "glasses") {
-        clothingItem = imread(clothPath, IMREAD_UNCHANGED);
-        itemSize = calculateGlassesSize(keypoints, clothingItem);
-        itemLocation = calculateGlassesPosition(keypoints, itemSize);
+
+    string precisionBenchList = optionValue(argc, argv, "--bench-precision");
+    if (!precisionBenchList.empty()) {
+        return runPrecisionBenchmark(modelPath, protoPath, precisionBenchList,
+            atoi(optionValue(argc, argv, "--precision", "3").c_str()),
+            atoi(optionValue(argc, argv, "--precision-side", "496").c_str()));
     }
-    else {
-        cerr << "[ERROR] Неверный тип одежды!" << endl;
-        return;
+
+    string benchList = optionValue(argc, argv, "--bench-exits");
+    if (!benchList.empty()) {
+        return runExitBenchmark(modelPath, protoPath, benchList, exitThreshold);
     }
 
-    // Наложение выбранной одежды на изображение
-    output = overlayImage(person, clothingItem, itemLocation, itemSize);
+    bool multiPerson = hasFlag(argc, argv, "--multi");
+    BlendMode blendMode = hasFlag(argc, argv, "--seamless") ? BlendMode::MultiBand : BlendMode::Alpha;
+    bool personCrop = hasFlag(argc, argv, "--crop-person");
+    bool compressGarments = hasFlag(argc, argv, "--compress-garments");
+    int precisionScales = atoi(optionValue(argc, argv, "--precision", "1").c_str());
+    int precisionSide = atoi(optionValue(argc, argv, "--precision-side", "496").c_str());
+    string int8Calibration = optionValue(argc, argv, "--int8");
 
-    // Сохранение и отображение результата
-    imwrite("result_with_selected_item.jpg", output);
-    //imshow("Result", output);
-    waitKey(0);
-}
+    SharedFrameWriter sharedFrame;
+    SharedFrameWriter* frameSink = nullptr;
+    string shmName = optionValue(argc, argv, "--shm");
+    if (!shmName.empty()) {
+        if (!sharedFrame.open(shmName)) {
+            return -1;
+        }
+        frameSink = &sharedFrame;
+    }
 
-// --- Главная функция (обновленная) ---
+    if (hasFlag(argc, argv, "--serve")) {
+        TryOnEngine engine;
+        if (!engine.load(modelPath, protoPath)) {
+            return -1;
+        }
+        engine.setFrameSink(frameSink);
+        engine.setMultiPerson(multiPerson);
+        engine.setBlendMode(blendMode);
+        engine.setPersonCrop(personCrop);
+        engine.setGarmentCompression(compressGarments);
+        engine.setPrecision(precisionScales, precisionSide);
+        if (!int8Calibration.empty() && !engine.setInt8(int8Calibration)) {
+            return -1;
+        }
+        if (!earlyExit.empty() && !engine.setEarlyExit(earlyExit, exitThreshold)) {
+            return -1;
+        }
+        CatalogWatcher catalogWatcher;
+        string watchedCatalog = optionValue(argc, argv, "--watch");
+        if (!watchedCatalog.empty()) {
+            if (!catalogWatcher.start(watchedCatalog, catalogRoot, compressGarments)) {
+                return -1;
+            }
+            engine.setCatalogWatcher(&catalogWatcher);
+        }
+        engine.warmUp(atoi(optionValue(argc, argv, "--warmup", "1").c_str()));
+        runServeMode(engine, metricsPath, optionValue(argc, argv, "--capture"));
+        return 0;
+    }
 
-string readFileToString(const string& filePath) {
-    ifstream inputFile(filePath);
-    if (!inputFile.is_open()) {
-        cerr << "[ERROR] Не удалось открыть файл: " << filePath << endl;
-        return "";
+    string loadCorpus = optionValue(argc, argv, "--loadgen");
+    string replayPath = optionValue(argc, argv, "--replay");
+    if (!loadCorpus.empty() || !replayPath.empty()) {
+        eventsEnabled = false;
+        int concurrency = max(1, atoi(optionValue(argc, argv, "--concurrency", "8").c_str()));
+        string defaultEngines = replayPath.empty() ? to_string(min(concurrency, 2)) : "1";
+        int engineCount = max(1, atoi(optionValue(argc, argv, "--engines", defaultEngines).c_str()));
+        LoadTestRunner runner(modelPath, protoPath, engineCount, multiPerson, blendMode);
+        if (!runner.ready()) {
+            return -1;
+        }
+        int status = replayPath.empty()
+            ? runLoadGenerator(runner, loadCorpus, concurrency, atof(optionValue(argc, argv, "--rate", "0").c_str()),
+                atof(optionValue(argc, argv, "--duration", "30").c_str()))
+            : runReplay(runner, replayPath, atof(optionValue(argc, argv, "--speed", "1").c_str()));
+        if (!metricsPath.empty()) {
+            engineMetrics.writeFile(metricsPath);
+        }
+        return status;
     }
-    string line;
-    getline(inputFile, line);
-    inputFile.close();
-    return line;
-}
 
-int main() {
-    setlocale(LC_ALL, "Russian");
+    string batchManifest = optionValue(argc, argv, "--batch");
+    if (!batchManifest.empty()) {
+        TryOnEngine engine;
+        if (!engine.load(modelPath, protoPath)) {
+            return -1;
+        }
+        engine.setMultiPerson(multiPerson);
+        engine.setBlendMode(blendMode);
+        engine.setPersonCrop(personCrop);
+        engine.setGarmentCompression(compressGarments);
+        engine.setPrecision(precisionScales, precisionSide);
+        if (!int8Calibration.empty() && !engine.setInt8(int8Calibration)) {
+            return -1;
+        }
+        if (!earlyExit.empty() && !engine.setEarlyExit(earlyExit, exitThreshold)) {
+            return -1;
+        }
+        engine.warmUp(atoi(optionValue(argc, argv, "--warmup", "1").c_str()));
+        return runBatchMode(engine, batchManifest, optionValue(argc, argv, "--out", "H:/OutfitME/outfit_me/batch_results"), metricsPath);
+    }
+
+    string videoPath = optionValue(argc, argv, "--video");
+    if (!videoPath.empty()) {
+        string clothingType = optionValue(argc, argv, "--wear");
+        string clothPath = optionValue(argc, argv, "--cloth");
+        if (clothingType.empty() || clothPath.empty()) {
+            logError("Для видео нужны --wear <тип> и --cloth <одежда>");
+            return -1;
+        }
+        bool reuseTrack = hasFlag(argc, argv, "--reuse-track");
+        TryOnEngine engine;
+        if (!reuseTrack) {
+            if (!engine.load(modelPath, protoPath)) {
+                return -1;
+            }
+            if (!earlyExit.empty() && !engine.setEarlyExit(earlyExit, exitThreshold)) {
+                return -1;
+            }
+            engine.setPrecision(precisionScales, precisionSide);
+            if (!int8Calibration.empty() && !engine.setInt8(int8Calibration)) {
+                return -1;
+            }
+            engine.warmUp(atoi(optionValue(argc, argv, "--warmup", "1").c_str()));
+        }
+        engine.setMultiPerson(multiPerson);
+        engine.setBlendMode(blendMode);
+        engine.setPersonCrop(personCrop, true);
+        engine.setGarmentCompression(compressGarments);
+        string defaultOutput = (fs::path(videoPath).parent_path() /
+            (fs::path(videoPath).stem().string() + "_" + fs::path(clothPath).stem().string() + ".mp4")).string();
+        return runVideoMode(engine, videoPath, clothPath, clothingType, optionValue(argc, argv, "--out", defaultOutput),
+            reuseTrack, metricsPath);
+    }
 
     // Чтение пути к изображению
     string personInput = "H:\\OutfitME\\outfit_me\\clTest\\x64\\Debug\\input.txt";
@@ -330,12 +6161,24 @@ int main() {
     }
 
     // Загрузка изображения
-    Mat person = imread(personPath);
+    Mat person;
+    {
+        StageTimer timer(Stage::Decode);
+        person = imread(personPath);
+    }
     if (person.empty()) {
-        cerr << "[ERROR] Не удалось загрузить изображение: " << personPath << endl;
+        logError("Не удалось загрузить изображение: %s", personPath.c_str());
         return -1;
     }
 
+    if (hasFlag(argc, argv, "--catalog")) {
+        processCatalogRequest(person, modelPath, protoPath);
+        if (!metricsPath.empty()) {
+            engineMetrics.writeFile(metricsPath);
+        }
+        return 0;
+    }
+
     // Чтение типа одежды
     string clothingTypePath = "H:\\OutfitME\\outfit_me\\clTest\\x64\\Debug\\wearType.txt";
     string clothingType = readFileToString(clothingTypePath);
@@ -343,13 +6186,14 @@ int main() {
         return -1;
     }
 
-    string modelPath = "H:/OutfitME/outfit_me/clTest/x64/Debug/pose_iter_584000.caffemodel";
-    string protoPath = "H:/OutfitME/outfit_me/openpose/models/pose/body_25/pose_deploy.prototxt";
-
-    processClothingRequest(clothingType, person, modelPath, protoPath);
+    processClothingRequest(clothingType, person, modelPath, protoPath, frameSink, multiPerson, blendMode, personCrop);
+    if (!metricsPath.empty()) {
+        engineMetrics.writeFile(metricsPath);
+    }
 
     return 0;
 }
+#endif
 
 
 
@@ -0,0 +1,333 @@
+// Тесты чистых функций движка: опорные точки одежды, сжатие одежды, дорожка поз,
+// ограничение повторов журнала.
+// Движок - один файл, поэтому он включается целиком, а его main отключается.
+// Сборка и запуск: cmake --build clTest/build && ctest --test-dir clTest/build
+#define CLTEST_NO_MAIN
+#include "../clTest.cpp"
+
+int failures = 0;
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            cerr << __FILE__ << ":" << __LINE__ << ": не выполнено: " #condition << endl; \
+            ++failures;                                                               \
+        }                                                                             \
+    } while (0)
+
+// Доступ к закрытому admit журнала (AsyncLogger объявляет этот класс другом)
+class AsyncLoggerTest {
+public:
+    static bool admit(AsyncLogger& logger, const char* format, long long second, int& suppressed) {
+        return logger.admit(format, second, suppressed);
+    }
+
+    static int burst() {
+        return AsyncLogger::logBurst;
+    }
+};
+
+// --- Сжатие одежды ---
+
+// Вещь с плавными градиентами цвета, прозрачной левой четвертью и полупрозрачным переходом
+Mat testGarment(Size size) {
+    Mat image(size, CV_8UC4);
+    for (int y = 0; y < size.height; ++y) {
+        for (int x = 0; x < size.width; ++x) {
+            int alpha = x < size.width / 4 ? 0 : min(255, (x - size.width / 4) * 20);
+            image.at<Vec4b>(y, x) = Vec4b(saturate_cast<uchar>(4 * x + y), saturate_cast<uchar>(2 * y + x),
+                saturate_cast<uchar>(128 + x - y), saturate_cast<uchar>(alpha));
+        }
+    }
+    return image;
+}
+
+// Та же билинейная формула, что в resizePackedGarment, но в double по целиком распакованной вещи
+Mat referenceResize(const Mat& source, Size size) {
+    Mat result(size, CV_8UC4);
+    double scaleX = static_cast<double>(source.cols) / size.width;
+    double scaleY = static_cast<double>(source.rows) / size.height;
+    for (int dy = 0; dy < size.height; ++dy) {
+        double sy = max(0.0, (dy + 0.5) * scaleY - 0.5);
+        int y0 = min(static_cast<int>(sy), source.rows - 1);
+        int y1 = min(y0 + 1, source.rows - 1);
+        double wy = sy - y0;
+        for (int dx = 0; dx < size.width; ++dx) {
+            double sx = max(0.0, (dx + 0.5) * scaleX - 0.5);
+            int x0 = min(static_cast<int>(sx), source.cols - 1);
+            int x1 = min(x0 + 1, source.cols - 1);
+            double wx = sx - x0;
+            for (int c = 0; c < 4; ++c) {
+                double upper = source.at<Vec4b>(y0, x0)[c] * (1 - wx) + source.at<Vec4b>(y0, x1)[c] * wx;
+                double lower = source.at<Vec4b>(y1, x0)[c] * (1 - wx) + source.at<Vec4b>(y1, x1)[c] * wx;
+                result.at<Vec4b>(dy, dx)[c] = saturate_cast<uchar>(upper * (1 - wy) + lower * wy);
+            }
+        }
+    }
+    return result;
+}
+
+int maxDifference(const Mat& first, const Mat& second) {
+    Mat difference;
+    absdiff(first, second, difference);
+    double maxValue = 0;
+    minMaxLoc(difference.reshape(1), nullptr, &maxValue);
+    return static_cast<int>(maxValue);
+}
+
+void testPackRoundTrip() {
+    // Размер не кратен 4: крайние блоки неполные
+    Mat garment = testGarment(Size(37, 29));
+    PackedGarment packed = packGarment(garment);
+    CHECK(packed.size == garment.size());
+    CHECK(packed.blocks.size() == static_cast<size_t>(10 * 8 * PACKED_BLOCK_BYTES));
+
+    Mat unpacked(garment.size(), CV_8UC4);
+    unpackGarment(packed, unpacked);
+
+    // Альфа хранится в 4 битах: ошибка не больше половины шага 255 / 15
+    double squaredError = 0;
+    long long visiblePixels = 0;
+    int alphaError = 0;
+    for (int y = 0; y < garment.rows; ++y) {
+        for (int x = 0; x < garment.cols; ++x) {
+            const Vec4b& original = garment.at<Vec4b>(y, x);
+            const Vec4b& restored = unpacked.at<Vec4b>(y, x);
+            alphaError = max(alphaError, abs(original[3] - restored[3]));
+            if (original[3] == 0) {
+                CHECK(restored[3] == 0);
+                continue;
+            }
+            for (int c = 0; c < 3; ++c) {
+                double d = original[c] - restored[c];
+                squaredError += d * d;
+            }
+            ++visiblePixels;
+        }
+    }
+    CHECK(alphaError <= 9);
+    double meanError = squaredError / (3.0 * visiblePixels);
+    CHECK(meanError == 0 || 10.0 * log10(255.0 * 255.0 / meanError) >= 30.0);
+
+    // Построчная распаковка (ею читает resizePackedGarment) совпадает с распаковкой целиком
+    vector<Vec4b> row(garment.cols);
+    for (int y = 0; y < garment.rows; ++y) {
+        unpackGarmentRow(packed, y, row.data());
+        CHECK(memcmp(row.data(), unpacked.ptr<Vec4b>(y), garment.cols * sizeof(Vec4b)) == 0);
+    }
+}
+
+void testResizePackedGarment() {
+    Mat garment = testGarment(Size(53, 41));
+    PackedGarment packed = packGarment(garment);
+    Mat unpacked(garment.size(), CV_8UC4);
+    unpackGarment(packed, unpacked);
+
+    // Одна арена на все размеры, как в движке: меньше полос, чем строк, уменьшение, увеличение
+    Mat rowArena;
+    const Size sizes[] = { Size(1, 1), Size(5, 3), Size(20, 14), Size(53, 41), Size(120, 97), Size(17, 200) };
+    for (Size size : sizes) {
+        Mat item(size, CV_8UC4);
+        resizePackedGarment(packed, item, rowArena);
+        CHECK(maxDifference(item, referenceResize(unpacked, size)) <= 1);
+
+        Mat expected;
+        resize(unpacked, expected, size, 0, 0, INTER_LINEAR);
+        CHECK(maxDifference(item, expected) <= 2);
+    }
+}
+
+// --- Дорожка поз ---
+
+void checkPoseFrame(const PoseFrame& written, const PoseFrame& read) {
+    CHECK(read.people.size() == written.people.size());
+    CHECK(read.confidences.size() == written.people.size());
+    if (read.people.size() != written.people.size() || read.confidences.size() != written.people.size()) {
+        return;
+    }
+    for (size_t person = 0; person < written.people.size(); ++person) {
+        CHECK(read.people[person].size() == static_cast<size_t>(poseTrackKeypoints));
+        CHECK(read.confidences[person].size() == static_cast<size_t>(poseTrackKeypoints));
+        if (read.people[person].size() != static_cast<size_t>(poseTrackKeypoints) ||
+            read.confidences[person].size() != static_cast<size_t>(poseTrackKeypoints)) {
+            continue;
+        }
+        const vector<Point>& keypoints = written.people[person];
+        const vector<float>* confidences = person < written.confidences.size() ? &written.confidences[person] : nullptr;
+        for (int i = 0; i < poseTrackKeypoints; ++i) {
+            Point point = i < static_cast<int>(keypoints.size()) ? keypoints[i] : Point(-1, -1);
+            if (point.x < 0 || point.y < 0) {
+                CHECK(read.people[person][i] == Point(-1, -1));
+                CHECK(read.confidences[person][i] == 0.0f);
+                continue;
+            }
+            // Уверенность хранится байтом, найденная точка - не меньше 1/255
+            float confidence = confidences != nullptr && i < static_cast<int>(confidences->size()) ? (*confidences)[i] : 1.0f;
+            float expected = min(255, max(1, cvRound(confidence * 255))) / 255.0f;
+            CHECK(read.people[person][i] == point);
+            CHECK(fabs(read.confidences[person][i] - expected) < 1e-6f);
+        }
+    }
+}
+
+void testPoseTrackRoundTrip() {
+    vector<PoseFrame> frames(4);
+    // Кадр 0: двое; у второго меньше 25 точек, часть не найдена, координаты в несколько байт varint
+    // и уверенностей меньше, чем точек
+    vector<Point> first, second;
+    vector<float> firstConfidences;
+    for (int i = 0; i < poseTrackKeypoints; ++i) {
+        first.push_back(Point(10 * i, 500 - 7 * i));
+        firstConfidences.push_back(0.04f * i);
+    }
+    for (int i = 0; i < 20; ++i) {
+        second.push_back(i % 2 == 0 ? Point(70000 + i, 3 * i) : Point(-1, -1));
+    }
+    frames[0].people = { first, second };
+    frames[0].confidences = { firstConfidences, vector<float>(10, 0.5f) };
+
+    // Кадр 1: только первый, сдвинут назад (отрицательные смещения)
+    vector<Point> moved = first;
+    for (Point& point : moved) {
+        point += Point(-5, 9);
+    }
+    frames[1].people = { moved };
+    frames[1].confidences = { firstConfidences };
+
+    // Кадр 2: никого; кадр 3: двое, у первого ни одной точки, второй сместился далеко
+    vector<Point> lost(poseTrackKeypoints, Point(-1, -1)), returned;
+    for (int i = 0; i < poseTrackKeypoints; ++i) {
+        returned.push_back(Point(i, i));
+    }
+    frames[3].people = { lost, returned };
+
+    string path = (fs::temp_directory_path() / "clTestTests.pose").string();
+    PoseTrackWriter writer;
+    CHECK(writer.open(path, Size(1280, 720), 29.97));
+    for (const PoseFrame& frame : frames) {
+        writer.write(frame);
+    }
+    CHECK(writer.close());
+    CHECK(!fs::exists(path + ".tmp"));
+
+    PoseTrackReader reader;
+    CHECK(reader.open(path));
+    CHECK(reader.frameSize == Size(1280, 720));
+    CHECK(reader.fps == 29.97);
+    PoseFrame pose;
+    for (const PoseFrame& frame : frames) {
+        CHECK(reader.read(pose));
+        checkPoseFrame(frame, pose);
+    }
+    CHECK(!reader.read(pose));
+
+    // Оборванный последний кадр не читается, предыдущие - читаются
+    error_code error;
+    fs::resize_file(path, fs::file_size(path) - 1, error);
+    CHECK(!error);
+    PoseTrackReader truncated;
+    CHECK(truncated.open(path));
+    for (size_t i = 0; i + 1 < frames.size(); ++i) {
+        CHECK(truncated.read(pose));
+    }
+    CHECK(!truncated.read(pose));
+    fs::remove(path, error);
+}
+
+// --- Ограничение повторов журнала ---
+
+void testAsyncLoggerAdmit() {
+    static const char formatA[] = "тест журнала A %d";
+    static const char formatB[] = "тест журнала B %d";
+    static const char formatC[] = "тест журнала C %d";
+    AsyncLogger logger;
+    const int burst = AsyncLoggerTest::burst();
+
+    // В пределах секунды проходят первые burst сообщений, остальные подавляются
+    int admitted = 0, suppressed = 0;
+    for (int i = 0; i < burst + 3; ++i) {
+        if (AsyncLoggerTest::admit(logger, formatA, 10, suppressed)) {
+            ++admitted;
+        }
+    }
+    CHECK(admitted == burst);
+    // У другой строки формата свой счетчик
+    CHECK(AsyncLoggerTest::admit(logger, formatB, 10, suppressed));
+    CHECK(suppressed == 0);
+    // В следующей секунде сообщение проходит и уносит число подавленных
+    CHECK(AsyncLoggerTest::admit(logger, formatA, 11, suppressed));
+    CHECK(suppressed == 3);
+    CHECK(AsyncLoggerTest::admit(logger, formatA, 11, suppressed));
+    CHECK(suppressed == 0);
+
+    // Из нескольких потоков в одной секунде проходит ровно burst сообщений, а подавленные
+    // не теряются: вместе с переданными дальше они дают все остальные
+    const int threadCount = 8, perThread = 1000;
+    atomic<int> concurrentAdmitted{ 0 }, reported{ 0 };
+    vector<thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < perThread; ++i) {
+                int count = 0;
+                if (AsyncLoggerTest::admit(logger, formatC, 20, count)) {
+                    ++concurrentAdmitted;
+                    reported += count;
+                }
+            }
+        });
+    }
+    for (thread& worker : threads) {
+        worker.join();
+    }
+    CHECK(concurrentAdmitted.load() == burst);
+    CHECK(AsyncLoggerTest::admit(logger, formatC, 21, suppressed));
+    CHECK(reported.load() + suppressed == threadCount * perThread - burst);
+}
+
+// --- Опорные точки правил одежды ---
+
+// Точки вне anchors не должны влиять на размер и положение: иначе ранний выход сети и
+// отчет INT8 пропустят точку, которую правило на самом деле читает
+void testClothingRuleAnchors() {
+    // Правдоподобная фигура: все 25 точек найдены и различны
+    vector<Point> body;
+    for (int i = 0; i < poseTrackKeypoints; ++i) {
+        body.push_back(Point(300 + 13 * (i % 5) - 40 * (i % 2), 100 + 31 * i));
+    }
+    const Size garmentSize(240, 320);
+    for (const ClothingRule& rule : clothingRules) {
+        vector<Point> keypoints = body;
+        Size size = rule.calculateSize(keypoints, garmentSize);
+        Point position = rule.calculatePosition(keypoints, size);
+        for (int i = 0; i < poseTrackKeypoints; ++i) {
+            if (find(rule.anchors.begin(), rule.anchors.end(), i) != rule.anchors.end()) {
+                continue;
+            }
+            for (Point changed : { body[i] + Point(57, -23), Point(-1, -1) }) {
+                keypoints = body;
+                keypoints[i] = changed;
+                Size changedSize = rule.calculateSize(keypoints, garmentSize);
+                bool same = changedSize == size && rule.calculatePosition(keypoints, changedSize) == position;
+                if (!same) {
+                    cerr << rule.type << ": точка " << i << " влияет на результат, но ее нет в anchors" << endl;
+                }
+                CHECK(same);
+            }
+        }
+    }
+}
+
+int main() {
+    testClothingRuleAnchors();
+    testPackRoundTrip();
+    testResizePackedGarment();
+    testPoseTrackRoundTrip();
+    testAsyncLoggerAdmit();
+
+    if (failures > 0) {
+        cerr << "Не выполнено проверок: " << failures << endl;
+        return 1;
+    }
+    cout << "Все проверки выполнены" << endl;
+    return 0;
+}
@@ -1,21 +1,79 @@
 import 'dart:core';
 import 'dart:io';
+import 'dart:typed_data';
 import 'package:flutter/material.dart';
+import 'package:flutter/services.dart';
 import 'dart:async';
 
+// Имя сегмента общей памяти, в который exe пишет кадры на Linux (--shm)
+const String resultTextureShm = '/outfitme_result';
+const MethodChannel _resultTextureChannel =
+    MethodChannel('outfitme/result_texture');
+
+// Текстура одна на приложение: ее делят карусель и экран результата, пока жив
+// резидентный движок (сегмент удаляется, когда он завершается)
+Future<int?>? _resultTextureAttach;
+
+Future<int?> attachResultTexture() => _resultTextureAttach ??=
+    _resultTextureChannel.invokeMethod<int>('attach', resultTextureShm);
+
+Future<void> resultTextureFrameAvailable() =>
+    _resultTextureChannel.invokeMethod('frameAvailable');
+
+Future<void> detachResultTexture() async {
+  if (_resultTextureAttach == null) {
+    return;
+  }
+  _resultTextureAttach = null;
+  try {
+    await _resultTextureChannel.invokeMethod('detach');
+  } catch (e) {
+    print('Ошибка отключения текстуры результата: $e');
+  }
+}
+
 class ResultScreen extends StatefulWidget {
-  const ResultScreen({super.key});
+  const ResultScreen({super.key, this.events, this.startRequest});
+
+  // Строки stdout резидентного движка: "preview <путь>" и "result <путь>" или
+  // "texture <ширина>x<высота>"; запрос завершают "allocs <n>" или "error <причина>".
+  // События карусели ("scrub", "scrub_texture", "scrub_error") идут в том же потоке и
+  // к примерке не относятся.
+  final Stream<String>? events;
+
+  // Отправляет "tryon" движку; вызывается после подписки на events, чтобы не потерять кадры
+  final VoidCallback? startRequest;
+
   @override
   _ResultScreenState createState() => _ResultScreenState();
 }
 
 class _ResultScreenState extends State<ResultScreen> {
   bool isProcessing = true;
+  Uint8List? previewImage;
+  Uint8List? resultImage;
+  int? textureId;
+  Size? textureSize;
+  StreamSubscription<String>? _engineEvents;
+  bool _requestDone = false;
 
   @override
   void initState() {
     super.initState();
-    _simulateProcessing();
+    if (widget.events != null && widget.startRequest != null) {
+      _engineEvents =
+          widget.events!.listen(_onEngineEvent, onDone: _onEngineClosed);
+      widget.startRequest!();
+    } else {
+      _simulateProcessing();
+    }
+  }
+
+  // Движок и текстура принадлежат экрану выбора, здесь только отписываемся
+  @override
+  void dispose() {
+    _engineEvents?.cancel();
+    super.dispose();
   }
 
   Future<void> _simulateProcessing() async {
@@ -25,6 +83,135 @@ class _ResultScreenState extends State<ResultScreen> {
     });
   }
 
+  // Движок завершился, не закончив запрос
+  void _onEngineClosed() {
+    if (mounted && isProcessing) {
+      setState(() {
+        isProcessing = false;
+      });
+    }
+  }
+
+  // Предпросмотр показываем сразу, полный результат подменяет его, когда готов
+  void _onEngineEvent(String line) {
+    final separator = line.indexOf(' ');
+    if (separator < 0 || _requestDone) {
+      return;
+    }
+    final event = line.substring(0, separator);
+    final path = line.substring(separator + 1);
+    if (event == 'texture') {
+      _onTextureFrame(path);
+      return;
+    }
+    if (event == 'allocs' || event == 'error') {
+      _requestDone = true; // дальше в потоке события уже других запросов
+      if (event == 'error') {
+        print('Движок не смог выполнить примерку: $path');
+      }
+      if (mounted) {
+        setState(() {
+          isProcessing = false;
+        });
+      }
+      return;
+    }
+    if (event != 'preview' && event != 'result') {
+      return;
+    }
+
+    Uint8List bytes;
+    try {
+      bytes = File(path).readAsBytesSync();
+    } catch (e) {
+      print('Ошибка чтения результата $path: $e');
+      return;
+    }
+    if (!mounted) {
+      return;
+    }
+    setState(() {
+      if (event == 'preview') {
+        previewImage = bytes;
+      } else {
+        resultImage = bytes;
+        isProcessing = false;
+      }
+    });
+  }
+
+  // Кадр уже лежит в общей памяти: подключаем текстуру один раз, дальше только сообщаем о новом кадре.
+  // Сначала приходит предпросмотр, затем полный результат; конец запроса - событие "allocs".
+  Future<void> _onTextureFrame(String size) async {
+    final parts = size.split('x');
+    if (parts.length != 2) {
+      return;
+    }
+    final frameSize =
+        Size(double.parse(parts[0]), double.parse(parts[1]));
+    try {
+      final id = await attachResultTexture();
+      await resultTextureFrameAvailable();
+      if (!mounted) {
+        return;
+      }
+      setState(() {
+        textureId = id;
+        textureSize = frameSize;
+      });
+    } catch (e) {
+      print('Ошибка подключения текстуры результата: $e');
+    }
+  }
+
+  Widget _buildResultImage() {
+    if (textureId != null && textureSize != null) {
+      return ClipRRect(
+        borderRadius: BorderRadius.circular(20),
+        child: SizedBox(
+          height: 500,
+          child: AspectRatio(
+            aspectRatio: textureSize!.width / textureSize!.height,
+            child: Texture(textureId: textureId!),
+          ),
+        ),
+      );
+    }
+    final image = resultImage ?? previewImage;
+    if (image == null) {
+      return Container(
+        height: 150,
+        width: 150,
+        decoration: BoxDecoration(
+          color: const Color.fromRGBO(245, 245, 245, 1),
+          borderRadius: BorderRadius.circular(75),
+          boxShadow: const [
+            BoxShadow(
+              color: Colors.black26,
+              blurRadius: 12,
+              spreadRadius: 6,
+              offset: Offset(0, 6),
+            ),
+          ],
+        ),
+        child: const Icon(
+          Icons.check_circle,
+          size: 120,
+          color: Color.fromRGBO(255, 69, 96, 1),
+        ),
+      );
+    }
+    return ClipRRect(
+      borderRadius: BorderRadius.circular(20),
+      child: Image.memory(
+        image,
+        height: 500,
+        fit: BoxFit.contain,
+        gaplessPlayback: true,
+      ),
+    );
+  }
+
   Future<void> downloadFile() async {
     const filePath = 'result_with_selected_item.jpg';
 
@@ -81,7 +268,7 @@ class _ResultScreenState extends State<ResultScreen> {
         elevation: 4,
       ),
       body: Center(
-        child: isProcessing
+        child: isProcessing && previewImage == null && textureId == null
             ? const Column(
                 mainAxisAlignment: MainAxisAlignment.center,
                 children: [
@@ -105,40 +292,32 @@ class _ResultScreenState extends State<ResultScreen> {
                 mainAxisAlignment: MainAxisAlignment.center,
                 children: [
                   const Spacer(flex: 2),
-                  const Text(
-                    "Готово!",
-                    style: TextStyle(
+                  Text(
+                    isProcessing ? "Почти готово..." : "Готово!",
+                    style: const TextStyle(
                         fontSize: 50,
                         fontWeight: FontWeight.w900,
                         color: Color.fromRGBO(255, 69, 96, 1)),
                   ),
                   const SizedBox(height: 20),
-                  Container(
-                    height: 150,
-                    width: 150,
-                    decoration: BoxDecoration(
-                      color: const Color.fromRGBO(245, 245, 245, 1),
-                      borderRadius: BorderRadius.circular(75),
-                      boxShadow: const [
-                        BoxShadow(
-                          color: Colors.black26,
-                          blurRadius: 12,
-                          spreadRadius: 6,
-                          offset: Offset(0, 6),
+                  _buildResultImage(),
+                  if (isProcessing)
+                    const Padding(
+                      padding: EdgeInsets.only(top: 10),
+                      child: SizedBox(
+                        width: 200,
+                        child: LinearProgressIndicator(
+                          color: Color.fromRGBO(255, 69, 96, 1),
                         ),
-                      ],
-                    ),
-                    child: const Icon(
-                      Icons.check_circle,
-                      size: 120,
-                      color: Color.fromRGBO(255, 69, 96, 1),
+                      ),
                     ),
-                  ),
                   const SizedBox(height: 40),
                   ElevatedButton(
-                    onPressed: () async {
-                      await downloadFile();
-                    },
+                    onPressed: isProcessing
+                        ? null
+                        : () async {
+                            await downloadFile();
+                          },
                     style: ButtonStyle(
                       backgroundColor: MaterialStateProperty.all<Color>(
                         const Color.fromRGBO(255, 69, 96, 1),
@@ -1,6 +1,9 @@
+import 'dart:async';
 import 'dart:core';
 import 'dart:ffi' hide Size;
 import 'dart:io';
+import 'dart:convert';
+import 'dart:typed_data';
 import 'package:scroll_snap_list/scroll_snap_list.dart';
 import 'package:flutter/material.dart';
 import 'package:image_picker/image_picker.dart';
@@ -161,8 +164,188 @@ class _ShowCaseOfImages extends State<ShowCase> {
   String textPhoto = "Выбрать фото";
   File? _selectedImage;
   int wearIndex = 0;
-  File? cloth = File('clTest/x64/Debug/wearPath.txt');
-  File wearType = File('clTest/x64/Debug/wearType.txt');
+
+  // Резидентный движок на весь экран: поза фото считается один раз ("session"),
+  // дальше вещь в центре карусели рисуется поверх без сети ("scrub"). Лишние кадры
+  // при быстрой прокрутке движок пропускает сам, показывается последняя вещь.
+  // "Примерить" отправляет тому же движку "tryon", вторую сеть не загружаем.
+  // На Linux кадры идут в текстуру общей памяти (--shm), иначе - JPEG-файлами.
+  static const double _carouselItemSize = 220;
+  final ScrollController _carouselController = ScrollController();
+  Process? _engine;
+  Future<Process?>? _engineStart;
+  // stdout движка, на него подписаны карусель и экран результата
+  Stream<String>? _engineEvents;
+  StreamSubscription<String>? _scrubEvents;
+  Uint8List? _scrubFrame;
+  int? _scrubTextureId;
+  Size? _scrubTextureSize;
+  int _scrubIndex = -1;
+
+  @override
+  void initState() {
+    super.initState();
+    _carouselController.addListener(_onCarouselScroll);
+  }
+
+  @override
+  void dispose() {
+    _carouselController.dispose();
+    _stopEngine();
+    super.dispose();
+  }
+
+  // Вещь под пальцем меняется раньше, чем карусель остановится (onItemFocus)
+  void _onCarouselScroll() {
+    final index = (_carouselController.offset / _carouselItemSize).round() %
+        images.length;
+    if (index != _scrubIndex) {
+      _sendScrub(index);
+    }
+  }
+
+  String _garmentPath(int index) =>
+      '${Directory.current.path}/${images[index]}';
+
+  void _sendScrub(int index) {
+    _scrubIndex = index;
+    _engine?.stdin
+        .writeln('scrub\t${_garmentPath(index)}\t${clothType[index]}');
+  }
+
+  // Движок запускается при первом фото, новое фото - только новый "session"
+  Future<Process?> _ensureEngine() => _engineStart ??= _launchEngine();
+
+  Future<Process?> _launchEngine() async {
+    try {
+      final engine = await Process.start(
+        Platform.isLinux
+            ? 'clTest/build/clTest'
+            : 'clTest\\x64\\Debug\\clTest.exe',
+        Platform.isLinux
+            ? ['--serve', '--shm', resultTextureShm]
+            : ['--serve'],
+        runInShell: false,
+      );
+      _engineEvents = engine.stdout
+          .transform(utf8.decoder)
+          .transform(const LineSplitter())
+          .asBroadcastStream();
+      _scrubEvents = _engineEvents!.listen(_onScrubEvent);
+      engine.stderr
+          .transform(utf8.decoder)
+          .transform(const LineSplitter())
+          .listen((line) => print('exe: $line'));
+      engine.exitCode.then((code) {
+        if (identical(_engine, engine)) {
+          print('Движок завершился с кодом $code');
+          if (mounted) {
+            setState(_forgetEngine);
+          } else {
+            _forgetEngine();
+          }
+        }
+      });
+      _engine = engine;
+    } catch (e) {
+      print('Ошибка запуска движка: $e');
+      _engineStart = null;
+    }
+    return _engine;
+  }
+
+  void _forgetEngine() {
+    _engine = null;
+    _engineStart = null;
+    _engineEvents = null;
+    _scrubEvents?.cancel();
+    _scrubEvents = null;
+    _scrubTextureId = null;
+    detachResultTexture();
+  }
+
+  // "quit" и ожидание выхода; если движок не вышел за 3 с - kill
+  Future<void> _stopEngine() async {
+    final pending = _engineStart;
+    if (pending == null) {
+      return;
+    }
+    _forgetEngine();
+    final engine = await pending;
+    _forgetEngine(); // запуск мог закончиться уже после остановки
+    if (engine == null) {
+      return;
+    }
+    try {
+      engine.stdin.writeln('quit');
+      await engine.stdin.flush();
+    } catch (e) {
+      print('Движок уже не принимает запросы: $e');
+    }
+    try {
+      await engine.exitCode.timeout(const Duration(seconds: 3));
+    } on TimeoutException {
+      print('Движок не завершился после quit, останавливаем принудительно');
+      engine.kill();
+    }
+  }
+
+  Future<void> _startSession(String photoPath) async {
+    final engine = await _ensureEngine();
+    if (engine == null) {
+      return;
+    }
+    engine.stdin.writeln('session\t$photoPath');
+    _sendScrub(wearIndex);
+  }
+
+  void _onScrubEvent(String line) {
+    if (line.startsWith('scrub_texture ')) {
+      _onScrubTexture(line.substring(14));
+      return;
+    }
+    if (line.startsWith('scrub_error ')) {
+      print('Движок не смог нарисовать кадр прокрутки: ${line.substring(12)}');
+      return;
+    }
+    if (line.startsWith('scrub ')) {
+      _onScrubFile(line.substring(6));
+    }
+  }
+
+  Future<void> _onScrubFile(String path) async {
+    try {
+      final bytes = await File(path).readAsBytes();
+      if (mounted) {
+        setState(() {
+          _scrubFrame = bytes;
+        });
+      }
+    } catch (e) {
+      print('Ошибка чтения кадра прокрутки: $e');
+    }
+  }
+
+  // Кадр уже в общей памяти: текстура подключается один раз, дальше только сообщаем о новом кадре
+  Future<void> _onScrubTexture(String size) async {
+    final parts = size.split('x');
+    if (parts.length != 2) {
+      return;
+    }
+    try {
+      final id = await attachResultTexture();
+      await resultTextureFrameAvailable();
+      if (mounted && _engine != null) {
+        setState(() {
+          _scrubTextureId = id;
+          _scrubTextureSize =
+              Size(double.parse(parts[0]), double.parse(parts[1]));
+        });
+      }
+    } catch (e) {
+      print('Ошибка подключения текстуры прокрутки: $e');
+    }
+  }
 
   Widget _buildItemList(BuildContext context, int index) {
     int adjustedIndex = index % images.length;
@@ -275,7 +458,8 @@ class _ShowCaseOfImages extends State<ShowCase> {
                 Expanded(
                   child: ScrollSnapList(
                     itemBuilder: _buildItemList,
-                    itemSize: 220,
+                    itemSize: _carouselItemSize,
+                    listController: _carouselController,
                     dynamicItemOpacity: 0.4,
                     dynamicItemSize: true,
                     itemCount: _itemCount,
@@ -296,36 +480,33 @@ class _ShowCaseOfImages extends State<ShowCase> {
           Center(
             child: ElevatedButton(
               onPressed: () async {
-                try {
-                  String exePath = 'clTest\\x64\\Debug\\clTest.exe';
-                  await Process.start(
-                    exePath,
-                    [],
-                    mode: ProcessStartMode.detached,
-                    runInShell: false,
-                  );
-                  print('Exe файл успешно запущен!');
-                } catch (e) {
-                  print('Ошибка при запуске exe файла: $e');
-                }
-                try {
-                  await cloth!.writeAsString(images[wearIndex]);
-                  print(
-                      ' файл с одеждой успешно записан с индексом $wearIndex!');
-                } catch (e) {
-                  print(" Ошибка сохранения пути одежды $e!");
+                // Фото из этого запуска или сохраненное в прошлый раз
+                String? photoPath = _selectedImage?.path;
+                if (photoPath == null) {
+                  try {
+                    photoPath = (await File('clTest/x64/Debug/input.txt')
+                            .readAsString())
+                        .trim();
+                  } catch (e) {
+                    print('Фото не выбрано: $e');
+                  }
                 }
-                try {
-                  await wearType.writeAsString(clothType[wearIndex]);
-                  print("тип одежды успешно записан");
-                } catch (e) {
-                  print("ошибка записи типа одежды! $e");
+                final engine =
+                    photoPath == null ? null : await _ensureEngine();
+                final events = _engineEvents;
+                final request =
+                    'tryon\t$photoPath\t${_garmentPath(wearIndex)}\t${clothType[wearIndex]}';
+                if (!context.mounted) {
+                  return;
                 }
-
                 Navigator.push(
                     context,
                     MaterialPageRoute(
-                        builder: (context) => const ResultScreen()));
+                        builder: (context) => ResultScreen(
+                            events: events,
+                            startRequest: engine == null
+                                ? null
+                                : () => engine.stdin.writeln(request))));
               },
               style: const ButtonStyle(
                 backgroundColor: WidgetStatePropertyAll<Color?>(
@@ -355,7 +536,25 @@ class _ShowCaseOfImages extends State<ShowCase> {
             child: ClipRRect(
               borderRadius: BorderRadius.circular(20),
               child: Center(
-                child: _selectedImage != null
+                child: _scrubTextureId != null && _scrubTextureSize != null
+                    ? FittedBox(
+                        fit: BoxFit.cover,
+                        clipBehavior: Clip.hardEdge,
+                        child: SizedBox(
+                          width: _scrubTextureSize!.width,
+                          height: _scrubTextureSize!.height,
+                          child: Texture(textureId: _scrubTextureId!),
+                        ),
+                      )
+                    : _scrubFrame != null
+                    ? Image.memory(
+                        _scrubFrame!,
+                        fit: BoxFit.cover,
+                        gaplessPlayback: true,
+                        width: double.infinity,
+                        height: double.infinity,
+                      )
+                    : _selectedImage != null
                     ? Image.file(
                         _selectedImage!,
                         fit: BoxFit.cover,
@@ -416,6 +615,7 @@ class _ShowCaseOfImages extends State<ShowCase> {
     });
     if (gainedImage != null) {
       await saveImagePathToFile(gainedImage.path);
+      _startSession(gainedImage.path);
       print('Путь изображения сохранен: ${gainedImage.path}');
     } else {
       print('Изображение не выбрано.');
@@ -0,0 +1,207 @@
+#include "result_texture_plugin.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+
+// Layout of the shared memory segment. Must match SharedFrameHeader in
+// clTest/clTest.cpp: a 64-byte header followed by three RGBA slots of
+// slot_capacity bytes each (triple buffer). `state` holds two slot indices:
+// bits 0-1 are the latest published frame, bits 2-3 the slot this plugin is
+// reading (kNoSlot for none). The engine only ever writes the slot that is
+// neither of them, so the slot claimed here stays intact until the next
+// copy_pixels call, while Flutter uploads it.
+struct SharedFrameHeader {
+  uint32_t magic;
+  uint32_t slot_capacity;
+  uint32_t width[3];
+  uint32_t height[3];
+  uint32_t state;
+  uint32_t sequence;
+};
+
+static constexpr uint32_t kSharedFrameMagic = 0x334D464F;  // "OFM3"
+static constexpr size_t kSharedFrameHeaderSize = 64;
+static constexpr uint32_t kNoSlot = 3;
+
+G_DECLARE_FINAL_TYPE(ResultTexture, result_texture, RESULT, TEXTURE,
+                     FlPixelBufferTexture)
+
+struct _ResultTexture {
+  FlPixelBufferTexture parent_instance;
+  uint8_t* mapping;
+  size_t mapping_size;
+};
+
+G_DEFINE_TYPE(ResultTexture, result_texture, fl_pixel_buffer_texture_get_type())
+
+// Implements FlPixelBufferTexture::copy_pixels.
+// Claims the latest slot and hands it to Flutter directly, no intermediate
+// copy is made.
+static gboolean result_texture_copy_pixels(FlPixelBufferTexture* texture,
+                                           const uint8_t** out_buffer,
+                                           uint32_t* width, uint32_t* height,
+                                           GError** error) {
+  ResultTexture* self = RESULT_TEXTURE(texture);
+  SharedFrameHeader* header =
+      reinterpret_cast<SharedFrameHeader*>(self->mapping);
+  if (header == nullptr ||
+      __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != kSharedFrameMagic) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "Shared frame is not initialized");
+    return FALSE;
+  }
+
+  // The engine only changes the latest slot, so the retry loop is short.
+  uint32_t state = __atomic_load_n(&header->state, __ATOMIC_ACQUIRE);
+  uint32_t slot;
+  do {
+    slot = state & 3;
+    if (slot == kNoSlot) {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                  "No frame has been published yet");
+      return FALSE;
+    }
+  } while (!__atomic_compare_exchange_n(&header->state, &state,
+                                        (state & ~(3u << 2)) | (slot << 2),
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE));
+  *out_buffer = self->mapping + kSharedFrameHeaderSize +
+                slot * static_cast<size_t>(header->slot_capacity);
+  *width = header->width[slot];
+  *height = header->height[slot];
+  return TRUE;
+}
+
+static void result_texture_dispose(GObject* object) {
+  ResultTexture* self = RESULT_TEXTURE(object);
+  if (self->mapping != nullptr) {
+    munmap(self->mapping, self->mapping_size);
+    self->mapping = nullptr;
+  }
+  G_OBJECT_CLASS(result_texture_parent_class)->dispose(object);
+}
+
+static void result_texture_class_init(ResultTextureClass* klass) {
+  FL_PIXEL_BUFFER_TEXTURE_CLASS(klass)->copy_pixels =
+      result_texture_copy_pixels;
+  G_OBJECT_CLASS(klass)->dispose = result_texture_dispose;
+}
+
+static void result_texture_init(ResultTexture* self) {}
+
+// Maps the shared memory segment created by the engine. Pixels are only read,
+// but the header is written to claim the slot being uploaded.
+static ResultTexture* result_texture_new(const gchar* shm_name) {
+  int fd = shm_open(shm_name, O_RDWR, 0);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < kSharedFrameHeaderSize) {
+    close(fd);
+    return nullptr;
+  }
+  void* address =
+      mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    return nullptr;
+  }
+
+  ResultTexture* self =
+      RESULT_TEXTURE(g_object_new(result_texture_get_type(), nullptr));
+  self->mapping = static_cast<uint8_t*>(address);
+  self->mapping_size = info.st_size;
+  return self;
+}
+
+typedef struct {
+  FlTextureRegistrar* texture_registrar;
+  ResultTexture* texture;
+} ResultTexturePlugin;
+
+static void result_texture_plugin_detach(ResultTexturePlugin* self) {
+  if (self->texture != nullptr) {
+    fl_texture_registrar_unregister_texture(self->texture_registrar,
+                                            FL_TEXTURE(self->texture));
+    g_clear_object(&self->texture);
+  }
+}
+
+static void result_texture_plugin_free(gpointer data) {
+  ResultTexturePlugin* self = static_cast<ResultTexturePlugin*>(data);
+  result_texture_plugin_detach(self);
+  g_clear_object(&self->texture_registrar);
+  g_free(self);
+}
+
+// Handles "attach" (shm name -> texture id), "frameAvailable" and "detach".
+static void result_texture_plugin_method_call(FlMethodChannel* channel,
+                                              FlMethodCall* method_call,
+                                              gpointer user_data) {
+  ResultTexturePlugin* self = static_cast<ResultTexturePlugin*>(user_data);
+  const gchar* method = fl_method_call_get_name(method_call);
+  FlValue* args = fl_method_call_get_args(method_call);
+
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (strcmp(method, "attach") == 0) {
+    if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_STRING) {
+      response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "bad_args", "Expected shared memory name", nullptr));
+    } else {
+      result_texture_plugin_detach(self);
+      self->texture = result_texture_new(fl_value_get_string(args));
+      if (self->texture == nullptr) {
+        response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+            "shm_failed", "Could not map shared frame", nullptr));
+      } else {
+        fl_texture_registrar_register_texture(self->texture_registrar,
+                                              FL_TEXTURE(self->texture));
+        g_autoptr(FlValue) result =
+            fl_value_new_int(fl_texture_get_id(FL_TEXTURE(self->texture)));
+        response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+      }
+    }
+  } else if (strcmp(method, "frameAvailable") == 0) {
+    if (self->texture != nullptr) {
+      fl_texture_registrar_mark_texture_frame_available(
+          self->texture_registrar, FL_TEXTURE(self->texture));
+    }
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "detach") == 0) {
+    result_texture_plugin_detach(self);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else {
+    response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
+  }
+
+  fl_method_call_respond(method_call, response, nullptr);
+}
+
+void result_texture_plugin_register(FlPluginRegistry* registry) {
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(registry,
+                                                  "ResultTexturePlugin");
+
+  ResultTexturePlugin* plugin = g_new0(ResultTexturePlugin, 1);
+  plugin->texture_registrar = FL_TEXTURE_REGISTRAR(
+      g_object_ref(fl_plugin_registrar_get_texture_registrar(registrar)));
+
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  g_autoptr(FlMethodChannel) channel = fl_method_channel_new(
+      fl_plugin_registrar_get_messenger(registrar), "outfitme/result_texture",
+      FL_METHOD_CODEC(codec));
+  // The channel owns the plugin state and frees it when the handler is
+  // replaced or the channel is destroyed.
+  fl_method_channel_set_method_call_handler(channel,
+                                            result_texture_plugin_method_call,
+                                            plugin, result_texture_plugin_free);
+  // Keep the channel alive for the lifetime of the application.
+  g_object_ref(channel);
+}
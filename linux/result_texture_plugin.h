@@ -0,0 +1,17 @@
+#ifndef FLUTTER_RESULT_TEXTURE_PLUGIN_H_
+#define FLUTTER_RESULT_TEXTURE_PLUGIN_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+/**
+ * result_texture_plugin_register:
+ * @registry: the plugin registry of the Flutter view.
+ *
+ * Registers the "outfitme/result_texture" method channel. The try-on engine
+ * (clTest) publishes result frames into a POSIX shared memory segment and the
+ * plugin exposes that segment to Dart as an #FlPixelBufferTexture, so results
+ * are shown without JPEG encoding or touching the filesystem.
+ */
+void result_texture_plugin_register(FlPluginRegistry* registry);
+
+#endif  // FLUTTER_RESULT_TEXTURE_PLUGIN_H_